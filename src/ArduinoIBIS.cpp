@@ -23,7 +23,20 @@
 
 #include "ArduinoIBIS.h"
 
+static_assert(IBIS_TX_QUEUE_SIZE <= 127, "Queue slots are linked with int8_t indices");
+
+// Time a frame of the given length takes on the wire (11 bits per byte with 7E2), rounded up
+static uint32_t GetWireTimeMs(uint16_t length)
+{
+	return ((uint32_t)length * 11 * 1000 + IBIS_BAUD - 1) / IBIS_BAUD;
+}
+
 bool ArduinoIBIS::Port::Begin(int8_t txPin, int8_t rxPin, bool invert)
+{
+	return Begin(txPin, rxPin, invert ? Polarity::Inverted : Polarity::Normal);
+}
+
+bool ArduinoIBIS::Port::Begin(int8_t txPin, int8_t rxPin, Polarity polarity)
 {
 	// Don't do anything if there's already a port created
 	if (_port != nullptr)
@@ -32,27 +45,135 @@ bool ArduinoIBIS::Port::Begin(int8_t txPin, int8_t rxPin, bool invert)
 		return false;
 	}
 
+	_txPin = txPin;
+	_rxPin = rxPin;
+	_detectingPolarity = false;
+
+	if (polarity == Polarity::Auto)
+	{
+		if (rxPin < 0)
+		{
+			polarity = Polarity::Normal;
+		}
+		else
+		{
+			polarity = SampleIdlePolarity();
+			if (polarity == Polarity::Auto)
+			{
+				if (_debug) _debugOutput->println("ArduinoIBIS: Bus is busy, detecting polarity from received frames");
+				polarity = Polarity::Normal;
+			}
+
+			_detectingPolarity = true;
+			_detectValidFrames = 0;
+			_detectBytes = 0;
+		}
+	}
+
+	_polarity = polarity;
+	if (!OpenSerial(polarity == Polarity::Inverted))
+	{
+		return false;
+	}
+
+	if (_debug) _debugOutput->println("ArduinoIBIS: Successfully created IBIS port");
+	return true;
+}
+
+bool ArduinoIBIS::Port::OpenSerial(bool invert)
+{
 	// Create a new port and begin transmission
-	_port = new EspSoftwareSerial::UART(rxPin, txPin, invert);
+	_port = new EspSoftwareSerial::UART(_rxPin, _txPin, invert);
 	_port->begin(IBIS_BAUD, IBIS_SERIAL_CONFIG);
 	if ((*_port) == false)
 	{
 		// The port has failed to initialize
 		if (_debug) _debugOutput->println("ArduinoIBIS: Failed to begin SoftwareSerial port");
+		delete _port;
+		_port = nullptr;
 		return false;
 	}
-
-	if (_debug) _debugOutput->println("ArduinoIBIS: Successfully created IBIS port");
 	return true;
 }
 
+ArduinoIBIS::Polarity ArduinoIBIS::Port::SampleIdlePolarity() const
+{
+	// A UART line idles in the mark state, which is high unless the interface inverts it
+	pinMode(_rxPin, INPUT);
+	uint8_t high = 0;
+	for (uint8_t i = 0; i < IBIS_POLARITY_SAMPLES; i++)
+	{
+		if (digitalRead(_rxPin) == HIGH)
+		{
+			high++;
+		}
+		delayMicroseconds(IBIS_POLARITY_SAMPLE_MICROS);
+	}
+
+	if (high == IBIS_POLARITY_SAMPLES)
+	{
+		return Polarity::Normal;
+	}
+	if (high == 0)
+	{
+		return Polarity::Inverted;
+	}
+	return Polarity::Auto;
+}
+
+void ArduinoIBIS::Port::UpdatePolarityDetection()
+{
+	if (_detectValidFrames >= IBIS_POLARITY_VALID_FRAMES)
+	{
+		_detectingPolarity = false;
+		if (_debug)
+		{
+			_debugOutput->print("ArduinoIBIS: Detected ");
+			_debugOutput->print(_polarity == Polarity::Inverted ? "inverted" : "normal");
+			_debugOutput->println(" polarity");
+		}
+		return;
+	}
+
+	if (_detectBytes < IBIS_POLARITY_TEST_BYTES || _detectValidFrames > 0)
+	{
+		return;
+	}
+
+	// Nothing decoded, so try the other polarity. The serial port has to be recreated, as the inversion is fixed
+	// when it's constructed
+	_polarity = _polarity == Polarity::Inverted ? Polarity::Normal : Polarity::Inverted;
+	if (_debug) _debugOutput->println("ArduinoIBIS: Received bytes don't decode, switching polarity");
+
+	_port->end();
+	delete _port;
+	_port = nullptr;
+	_rxLength = 0;
+	_rxAwaitingChecksum = false;
+	_rxOverflow = false;
+	_detectBytes = 0;
+
+	if (!OpenSerial(_polarity == Polarity::Inverted))
+	{
+		_detectingPolarity = false;
+	}
+}
+
 void ArduinoIBIS::Port::End()
 {
 	if (_port != nullptr)
 	{
 		_port->end();
+		delete _port;
 		_port = nullptr;
 	}
+	_detectingPolarity = false;
+
+	// Whatever is still queued can't be sent anymore
+	while (_queueCount > 0)
+	{
+		TransmitQueued();
+	}
 }
 
 void ArduinoIBIS::Port::SetDebugOutput(bool enable, Stream* outputStream)
@@ -61,149 +182,870 @@ void ArduinoIBIS::Port::SetDebugOutput(bool enable, Stream* outputStream)
 	_debugOutput = outputStream;
 }
 
-void ArduinoIBIS::Port::DS010e(const char* sign, uint16_t delay)
+void ArduinoIBIS::Port::SetQueueEnabled(bool enable)
 {
-	char buf[IBIS_TELEGRAM_BUFFER_SIZE];
-	printf(buf, "xV%.1s%03d", sign, delay);
-	SendTelegram(buf);
+	_queueEnabled = enable;
 }
 
-void ArduinoIBIS::Port::DS003a(const String& text)
+void ArduinoIBIS::Port::SetProducer(uint8_t producer, uint8_t weight, uint8_t quota)
 {
-	String telegram = "zA";
+	if (producer >= IBIS_MAX_PRODUCERS)
+	{
+		if (_debug) _debugOutput->println("ArduinoIBIS: Cannot set producer, id is out of range");
+		return;
+	}
 
-	uint8_t numBlocks = ceil(text.length() / 16.0);
-	telegram.concat(ToHexString(numBlocks));
-	telegram.concat(text);
+	_producers[producer].weight = weight > 0 ? weight : 1;
+	_producers[producer].quota = quota > 0 && quota < IBIS_TX_QUEUE_SIZE ? quota : IBIS_TX_QUEUE_SIZE;
+	_queueEnabled = true;
+}
 
-	// Fill the remaining string with blank spaces (if any)
-	uint8_t remainder = text.length() % 16;
-	if (remainder > 0)
+void ArduinoIBIS::Port::SetSlotScheduling(bool enable, uint16_t guardMs)
+{
+	_slotScheduling = enable;
+	_slotGuard = guardMs;
+	_slotSeen = false;
+	_slotConfidence = 0;
+	_slotPeriod = 0;
+	_slotDuration = 0;
+	if (enable)
+	{
+		_queueEnabled = true;
+	}
+}
+
+void ArduinoIBIS::Port::SetDeviceProfile(uint8_t address, const DeviceProfile* profile)
+{
+	if (address < IBIS_MAX_DEVICES)
+	{
+		_devices[address] = profile;
+	}
+}
+
+const ArduinoIBIS::TextEncoding* ArduinoIBIS::Port::GetEncoding(uint8_t address) const
+{
+	if (address < IBIS_MAX_DEVICES && _devices[address] != nullptr && _devices[address]->encoding != nullptr)
+	{
+		return _devices[address]->encoding;
+	}
+
+	return _encoding;
+}
+
+void ArduinoIBIS::Port::SetTraceOutput(Stream* outputStream)
+{
+	_traceOutput = outputStream;
+
+	// The JSON array format allows omitting the closing bracket, so the trace stays valid no matter when capturing stops
+	if (_traceOutput != nullptr)
 	{
-		for (uint8_t i = 16; i > remainder; i--)
+		_traceOutput->println("[");
+	}
+}
+
+void ArduinoIBIS::Port::SetCaptureCallback(CaptureCallback callback, void* context)
+{
+	_captureCallback = callback;
+	_captureContext = context;
+}
+
+void ArduinoIBIS::Port::SetTelemetryCallback(uint32_t intervalMs, TelemetryCallback callback, void* context)
+{
+	_telemetryInterval = intervalMs;
+	_telemetryCallback = callback;
+	_telemetryContext = context;
+	_telemetryStart = millis();
+	_stats = Statistics();
+}
+
+uint8_t ArduinoIBIS::Port::WriteTelemetryRecord(uint8_t (&record)[IBIS_TELEMETRY_RECORD_SIZE]) const
+{
+	uint8_t length = 0;
+	auto writeVarint = [&](uint32_t value)
+	{
+		// LEB128: 7 bits per byte, the high bit marks that another byte follows
+		while (value >= 0x80)
 		{
-			telegram.concat(" ");
+			record[length++] = (uint8_t)(value | 0x80);
+			value >>= 7;
 		}
+		record[length++] = (uint8_t)value;
+	};
+
+	record[length++] = IBIS_TELEMETRY_VERSION;
+	writeVarint(millis() - _telemetryStart);
+	writeVarint(_stats.telegramsSent);
+	writeVarint(_stats.bytesSent);
+	writeVarint(_stats.sendErrors);
+	for (uint8_t i = 0; i < IBIS_LATENCY_BUCKETS; i++)
+	{
+		writeVarint(_stats.latencyHistogram[i]);
 	}
+	writeVarint(_stats.maxLatencyMs);
+	writeVarint(_stats.telegramsReceived);
+	writeVarint(_stats.receiveErrors);
+	writeVarint(_stats.maxRunMicros);
 
-	SendTelegram(telegram);
+	return length;
 }
 
-void ArduinoIBIS::Port::DS003c(const String& text)
+int8_t ArduinoIBIS::Port::AddTimer(uint32_t intervalMs, TimerCallback callback, void* context, bool repeat)
 {
-	String telegram = "zI";
+	for (int8_t i = 0; i < IBIS_MAX_TIMERS; i++)
+	{
+		Timer& timer = _timers[i];
+		if (timer.callback == nullptr)
+		{
+			timer.due = millis() + intervalMs;
+			timer.interval = intervalMs;
+			timer.callback = callback;
+			timer.context = context;
+			timer.repeat = repeat;
+			return i;
+		}
+	}
 
-	uint8_t numBlocks = ceil(text.length() / 4.0);
-	telegram.concat(ToHexString(numBlocks));
-	telegram.concat(text);
+	if (_debug) _debugOutput->println("ArduinoIBIS: Cannot add timer, all timers are in use");
+	return -1;
+}
 
-	// Fill the remaining string with blank spaces (if any)
-	uint8_t remainder = text.length() % 4;
-	if (remainder > 0)
+void ArduinoIBIS::Port::RemoveTimer(int8_t handle)
+{
+	if (handle >= 0 && handle < IBIS_MAX_TIMERS)
+	{
+		_timers[handle] = Timer();
+	}
+}
+
+void ArduinoIBIS::Port::SetReceiveCallback(ReceiveCallback callback, void* context)
+{
+	_receiveCallback = callback;
+	_receiveContext = context;
+}
+
+void ArduinoIBIS::Port::ExpectResponse(uint32_t timeoutMs, ReceiveCallback callback, void* context)
+{
+	// Open the new window before closing the previous one, so a window opened again by the previous callback isn't
+	// overwritten (it closes the new one instead)
+	ReceiveCallback previous = _responseCallback;
+	void* previousContext = _responseContext;
+
+	_responseCallback = callback;
+	_responseContext = context;
+	_responseDeadline = millis() + timeoutMs;
+
+	if (previous != nullptr)
+	{
+		previous(*this, nullptr, 0, previousContext);
+	}
+}
+
+void ArduinoIBIS::Port::Run()
+{
+	uint32_t runStart = micros();
+
+	// Received bytes first, as SoftwareSerial's RX buffer is small
+	if (_port != nullptr)
+	{
+		int pending = _port->available();
+		for (uint8_t i = 0; i < IBIS_RX_BYTES_PER_RUN && pending > 0; i++)
+		{
+			uint8_t value = _port->read();
+			pending--;
+
+			// Bytes still waiting behind this one arrived after it, one byte time each (e.g. while we were sending)
+			if (_slotScheduling)
+			{
+				ObserveBusByte(value, millis() - GetWireTimeMs(pending));
+			}
+			ReceiveByte(value);
+		}
+
+		if (_detectingPolarity)
+		{
+			UpdatePolarityDetection();
+		}
+	}
+
+	// Transmit at most one queued telegram per call, as a single telegram already takes tens of milliseconds
+	TransmitQueued();
+
+	// Close the response window if it has expired
+	if (_responseCallback != nullptr && (int32_t)(_responseDeadline - millis()) <= 0)
+	{
+		ReceiveCallback callback = _responseCallback;
+		_responseCallback = nullptr;
+		callback(*this, nullptr, 0, _responseContext);
+	}
+
+	for (uint8_t i = 0; i < IBIS_MAX_TIMERS; i++)
 	{
-		for (uint8_t i = 4; i > remainder; i--)
+		Timer& timer = _timers[i];
+		uint32_t now = millis();
+		if (timer.callback == nullptr || (int32_t)(timer.due - now) > 0)
+		{
+			continue;
+		}
+
+		// Free one-shot timers before calling them, so the callback can schedule a new one in the same slot
+		TimerCallback callback = timer.callback;
+		void* context = timer.context;
+		if (timer.repeat)
+		{
+			// Keep the period stable, unless we're lagging behind by more than one period
+			timer.due += timer.interval;
+			if ((int32_t)(timer.due - now) <= 0)
+			{
+				timer.due = now + timer.interval;
+			}
+		}
+		else
 		{
-			telegram.concat(" ");
+			timer = Timer();
 		}
+
+		callback(*this, context);
 	}
 
-	SendTelegram(telegram);
+	_lastRunMicros = micros() - runStart;
+	if (_lastRunMicros > _stats.maxRunMicros)
+	{
+		_stats.maxRunMicros = _lastRunMicros;
+	}
+
+	UpdateTelemetry();
 }
 
-void ArduinoIBIS::Port::DS021(uint8_t address, String text)
+void ArduinoIBIS::Port::ObserveBusByte(uint8_t value, uint32_t now)
+{
+	// On interfaces that receive what they send, our own frame comes back right after it was sent. Bytes matching it
+	// are skipped, the first one that doesn't ends the echo
+	if (_echoPosition < _echoLength)
+	{
+		if (_echoPosition >= sizeof(_echo) || (uint8_t)_echo[_echoPosition] == value)
+		{
+			_echoPosition++;
+			return;
+		}
+		_echoLength = 0;
+	}
+
+	if (_slotSeen && (int32_t)(now - _slotLastByte) < IBIS_SLOT_BURST_GAP_MS)
+	{
+		// Still the same burst. Its duration rises quickly, but only falls slowly (see below), to stay on the safe side
+		_slotLastByte = now;
+		uint32_t duration = now - _slotBurstStart + GetWireTimeMs(1);
+		if (duration > _slotDuration)
+		{
+			_slotDuration = duration;
+		}
+		return;
+	}
+
+	// A new burst. If it came one period after the last one, the period is confirmed (and smoothed against the jitter
+	// of Run() calls). A single burst off the period costs confidence, only when there's none left the period is
+	// learned anew
+	if (_slotSeen)
+	{
+		uint32_t interval = now - _slotBurstStart;
+		uint32_t tolerance = _slotPeriod / 8;
+		if (_slotPeriod > 0 && interval + tolerance >= _slotPeriod && interval <= _slotPeriod + tolerance)
+		{
+			_slotPeriod = (3 * _slotPeriod + interval) / 4;
+			if (_slotConfidence < 0xFF)
+			{
+				_slotConfidence++;
+			}
+		}
+		else if (_slotConfidence > 0)
+		{
+			_slotConfidence--;
+		}
+		else
+		{
+			_slotPeriod = interval;
+		}
+	}
+
+	_slotSeen = true;
+	_slotBurstStart = now;
+	_slotLastByte = now;
+	_slotDuration = _slotDuration * 7 / 8;
+	if (_slotDuration < GetWireTimeMs(1))
+	{
+		_slotDuration = GetWireTimeMs(1);
+	}
+}
+
+uint32_t ArduinoIBIS::Port::GetSlotWait(uint16_t length) const
 {
-	String telegram = "aA";
+	if (!_slotSeen)
+	{
+		return 0;
+	}
 
-	uint8_t numBlocks = ceil(text.length() / 4.0);
-	telegram.concat(ToHexString(address));
-	telegram.concat(ToHexString(numBlocks));
-	telegram.concat(text.substring(0, numBlocks * 16));
+	// The other master is sending right now, or has just stopped
+	uint32_t now = millis();
+	uint32_t quiet = now - _slotLastByte;
+	uint32_t holdOff = IBIS_SLOT_BURST_GAP_MS + _slotGuard;
+	if (quiet < holdOff)
+	{
+		return holdOff - quiet;
+	}
+
+	// Frames that can't fit between two bursts would wait forever
+	uint32_t wire = GetWireTimeMs(length);
+	if (_slotConfidence < IBIS_SLOT_MIN_CONFIDENCE || wire + _slotDuration + 2 * _slotGuard >= _slotPeriod)
+	{
+		return 0;
+	}
 
-	SendTelegram(telegram);
+	// Start of the latest predicted burst, and whether we're still within it
+	uint32_t burst = _slotBurstStart + (now - _slotBurstStart) / _slotPeriod * _slotPeriod;
+	uint32_t burstEnd = burst + _slotDuration + _slotGuard;
+	if ((int32_t)(burstEnd - now) > 0)
+	{
+		return burstEnd - now;
+	}
+
+	// Send if we're done a guard time before the next burst, otherwise wait until it's over
+	uint32_t next = burst + _slotPeriod;
+	if ((int32_t)(now + wire + _slotGuard - next) <= 0)
+	{
+		return 0;
+	}
+	return burstEnd + _slotPeriod - now;
 }
 
-void ArduinoIBIS::Port::DS021a(uint8_t address, uint8_t stopId, String stopText, String changeText)
+void ArduinoIBIS::Port::ReceiveByte(uint8_t value)
+{
+	if (_detectingPolarity && _detectBytes < 0xFFFF)
+	{
+		_detectBytes++;
+	}
+
+	if (_rxAwaitingChecksum)
+	{
+		// The checksum covers every byte including the CR, starting at 0x7F (same as in Telegram::Finish)
+		char checksum = 0x7F;
+		for (uint8_t i = 0; i < _rxLength; i++)
+		{
+			checksum ^= _rxBuffer[i];
+		}
+		checksum ^= '\x0d';
+		bool valid = !_rxOverflow && checksum == (char)value;
+
+		if (_captureCallback != nullptr)
+		{
+			_rxBuffer[_rxLength] = '\x0d';
+			_rxBuffer[_rxLength + 1] = (char)value;
+			_captureCallback((const uint8_t*)_rxBuffer, _rxLength + 2, CaptureReceived | (valid ? CaptureChecksumValid : 0), _captureContext);
+		}
+
+		if (valid)
+		{
+			_stats.telegramsReceived++;
+			if (_detectingPolarity && _detectValidFrames < 0xFF)
+			{
+				_detectValidFrames++;
+			}
+			_rxBuffer[_rxLength] = '\0';
+			DispatchReceived(_rxBuffer, _rxLength);
+		}
+		else
+		{
+			_stats.receiveErrors++;
+			if (_debug) _debugOutput->println("ArduinoIBIS: Dropped received telegram (bad checksum or too long)");
+		}
+
+		_rxLength = 0;
+		_rxAwaitingChecksum = false;
+		_rxOverflow = false;
+		return;
+	}
+
+	if (value == '\x0d')
+	{
+		_rxAwaitingChecksum = true;
+	}
+	else if (_rxLength < IBIS_RX_BUFFER_SIZE - 1)
+	{
+		_rxBuffer[_rxLength++] = (char)value;
+	}
+	else
+	{
+		_rxOverflow = true;
+	}
+}
+
+void ArduinoIBIS::Port::DispatchReceived(const char* telegram, uint8_t length)
+{
+	if (_responseCallback != nullptr)
+	{
+		ReceiveCallback callback = _responseCallback;
+		_responseCallback = nullptr;
+		callback(*this, telegram, length, _responseContext);
+	}
+	else if (_receiveCallback != nullptr)
+	{
+		_receiveCallback(*this, telegram, length, _receiveContext);
+	}
+}
+
+uint32_t ArduinoIBIS::Port::GetTimeUntilNextDeadline() const
+{
+	uint32_t now = millis();
+	uint32_t next = IBIS_NO_DEADLINE;
+	auto consider = [&](uint32_t due)
+	{
+		int32_t remaining = (int32_t)(due - now);
+		uint32_t wait = remaining > 0 ? (uint32_t)remaining : 0;
+		if (wait < next)
+		{
+			next = wait;
+		}
+	};
+
+	for (uint8_t i = 0; i < IBIS_MAX_TIMERS; i++)
+	{
+		if (_timers[i].callback != nullptr)
+		{
+			consider(_timers[i].due);
+		}
+	}
+
+	if (_telemetryCallback != nullptr)
+	{
+		consider(_telemetryStart + _telemetryInterval);
+	}
+
+	if (_responseCallback != nullptr)
+	{
+		consider(_responseDeadline);
+	}
+
+	// Queued telegrams are due when their slot comes up (right away without slot scheduling)
+	if (_queueCount > 0)
+	{
+		consider(now + (_slotScheduling ? GetSlotWait(_queue[GetNextQueued()].length) : 0));
+	}
+
+	// Pending received bytes need to be processed right away
+	if (_port != nullptr && _port->available() > 0)
+	{
+		next = 0;
+	}
+
+	return next;
+}
+
+// Returns how much of a text with the given length fits into the available space, when it has to be padded to full
+// blocks. Texts that don't fit are cut at a block boundary
+static uint16_t FitToBlocks(uint16_t length, uint8_t blockSize, uint16_t available)
+{
+	uint16_t padded = (length + blockSize - 1) / blockSize * blockSize;
+	if (padded <= available)
+	{
+		return length;
+	}
+
+	return available / blockSize * blockSize;
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::DS010e(const char* sign, uint16_t delay)
+{
+	return Telegram::Format(nullptr, "xV%.1s%03d", sign, delay);
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::DS003a(const char* text, const TextEncoding* encoding)
+{
+	Telegram telegram;
+	telegram.Append("zA", 2);
+
+	// Texts are transcoded first, as the block count depends on the transcoded length. Two bytes are kept free for
+	// the block count
+	char data[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t length = TranscodeText(text, data, sizeof(data), encoding);
+	length = FitToBlocks(length, 16, telegram.GetRemaining() - 2);
+
+	uint8_t numBlocks = (length + 15) / 16;
+	telegram.AppendHex(numBlocks);
+	telegram.Append(data, length);
+
+	// Fill the remaining string with blank spaces (if any)
+	telegram.AppendPadding(numBlocks * 16 - length);
+
+	telegram.Finish();
+	return telegram;
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::DS003c(const char* text, const TextEncoding* encoding)
+{
+	Telegram telegram;
+	telegram.Append("zI", 2);
+
+	char data[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t length = TranscodeText(text, data, sizeof(data), encoding);
+	length = FitToBlocks(length, 4, telegram.GetRemaining() - 2);
+
+	uint8_t numBlocks = (length + 3) / 4;
+	telegram.AppendHex(numBlocks);
+	telegram.Append(data, length);
+
+	// Fill the remaining string with blank spaces (if any)
+	telegram.AppendPadding(numBlocks * 4 - length);
+
+	telegram.Finish();
+	return telegram;
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::DS021(uint8_t address, const char* text, const TextEncoding* encoding)
+{
+	Telegram telegram;
+	telegram.Append("aA", 2);
+
+	// Four bytes are kept free for the address and block count
+	char data[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t length = TranscodeText(text, data, telegram.GetRemaining() - 4, encoding);
+
+	uint8_t numBlocks = (length + 3) / 4;
+	telegram.AppendHex(address);
+	telegram.AppendHex(numBlocks);
+	telegram.Append(data, length);
+
+	telegram.Finish();
+	return telegram;
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::DS021a(uint8_t address, uint8_t stopId, const char* stopText, const char* changeText, const TextEncoding* encoding)
 {
-	String telegram = "aL";
+	Telegram telegram;
+	telegram.Append("aL", 2);
 
-	char data[80];
-	int len = sprintf(data, "\x03%02d\x04%s\x05%s", stopId, stopText.c_str(), changeText.c_str());
+	// Five bytes are kept free for the address, block count and remainder
+	char data[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t available = telegram.GetRemaining() - 5;
+	uint16_t len = snprintf(data, sizeof(data), "\x03%02d\x04", stopId);
+	len += TranscodeText(stopText, data + len, available - len, encoding);
+	if (len < available)
+	{
+		data[len++] = '\x05';
+		len += TranscodeText(changeText, data + len, available - len, encoding);
+	}
 
-	uint8_t numBlocks = ceil(len / 4.0);
+	uint8_t numBlocks = (len + 3) / 4;
 	uint8_t remainder = len % 4;
-	telegram.concat(ToHexString(address));
-	telegram.concat(ToHexString(numBlocks));
-	telegram.concat(ToHexString(remainder));
-	telegram.concat(data, len);
+	telegram.AppendHex(address);
+	telegram.AppendHex(numBlocks);
+	telegram.AppendHex(remainder);
+	telegram.Append(data, len);
 
-	SendTelegram(telegram);
+	telegram.Finish();
+	return telegram;
 }
 
-void ArduinoIBIS::Port::GSP(uint8_t address, String line1, String line2)
+ArduinoIBIS::Telegram ArduinoIBIS::Port::Build::GSP(uint8_t address, const char* line1, const char* line2, const TextEncoding* encoding)
 {
-	String lines = "";
-	lines.concat(line1);
-	if (line2.length() > 0)
+	Telegram telegram;
+	telegram.Append("aA", 2);
+
+	char lines[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t length = TranscodeText(line1, lines, sizeof(lines) - 3, encoding);
+	if (line2[0] != '\0')
 	{
-		lines.concat('\x0a'); // LF
+		lines[length++] = '\x0a'; // LF
+		length += TranscodeText(line2, lines + length, sizeof(lines) - 2 - length, encoding);
 	}
-	lines.concat(line2);
-	lines.concat("\x0a\x0a"); // LF LF
+	lines[length++] = '\x0a'; // LF LF
+	lines[length++] = '\x0a';
 
-	uint8_t numBlocks = ceil(lines.length() / 16.0);
-	uint8_t remainder = lines.length() % 16;
-	if (remainder > 0)
+	// Four bytes are kept free for the address and block count
+	length = FitToBlocks(length, 16, telegram.GetRemaining() - 4);
+
+	uint8_t numBlocks = (length + 15) / 16;
+	telegram.AppendHex(address);
+	telegram.AppendHex(numBlocks);
+	telegram.Append(lines, length);
+
+	// Fill the remaining string with blank spaces (if any)
+	telegram.AppendPadding(numBlocks * 16 - length);
+
+	telegram.Finish();
+	return telegram;
+}
+
+const char* ArduinoIBIS::Port::FitToDevice(uint8_t address, const char* text, char* buffer, uint16_t size) const
+{
+	const DeviceProfile* profile = address < IBIS_MAX_DEVICES ? _devices[address] : nullptr;
+	if (profile == nullptr || profile->width == 0)
 	{
-		for (uint8_t i = 16; i > remainder; i--)
+		return text;
+	}
+
+	// Texts longer than the buffer are cut at a character boundary first
+	uint16_t length = strlen(text);
+	if (length >= size)
+	{
+		length = size - 1;
+		while (length > 0 && (text[length] & 0xC0) == 0x80)
 		{
-			lines.concat(" ");
+			length--;
 		}
 	}
 
-	String telegram = "aA";
-	telegram.concat(ToHexString(address));
-	telegram.concat(ToHexString(numBlocks));
-	telegram.concat(lines);
+	length = FitUTF8Text(profile->font, GetEncoding(address), text, length, profile->width);
+	memcpy(buffer, text, length);
+	buffer[length] = '\0';
+	return buffer;
+}
+
+void ArduinoIBIS::Port::DS021(uint8_t address, String text)
+{
+	char fitted[IBIS_TELEGRAM_MAX_LENGTH];
+	Send(Build::DS021(address, FitToDevice(address, text.c_str(), fitted, sizeof(fitted)), GetEncoding(address)));
+}
+
+void ArduinoIBIS::Port::DS021a(uint8_t address, uint8_t stopId, String stopText, String changeText)
+{
+	char fittedStop[IBIS_TELEGRAM_MAX_LENGTH];
+	char fittedChange[IBIS_TELEGRAM_MAX_LENGTH];
+	const char* stop = FitToDevice(address, stopText.c_str(), fittedStop, sizeof(fittedStop));
+	const char* change = FitToDevice(address, changeText.c_str(), fittedChange, sizeof(fittedChange));
+	Send(Build::DS021a(address, stopId, stop, change, GetEncoding(address)));
+}
 
-	SendTelegram(telegram);
+void ArduinoIBIS::Port::GSP(uint8_t address, String line1, String line2)
+{
+	char fitted1[IBIS_TELEGRAM_MAX_LENGTH];
+	char fitted2[IBIS_TELEGRAM_MAX_LENGTH];
+	const char* first = FitToDevice(address, line1.c_str(), fitted1, sizeof(fitted1));
+	const char* second = FitToDevice(address, line2.c_str(), fitted2, sizeof(fitted2));
+	Send(Build::GSP(address, first, second, GetEncoding(address)));
 }
 
-void ArduinoIBIS::Port::SendTelegram(String telegram)
+bool ArduinoIBIS::Port::Send(const Telegram& telegram, uint8_t producer, SendCallback callback, void* context)
 {
 	if (_port == nullptr)
 	{
 		if (_debug) _debugOutput->println("ArduinoIBIS: Cannot send, port is null!");
+		_stats.sendErrors++;
+		UpdateTelemetry();
+		return false;
+	}
+
+	if (!telegram.IsValid() || producer >= IBIS_MAX_PRODUCERS)
+	{
+		if (_debug) _debugOutput->println("ArduinoIBIS: Cannot send, telegram is incomplete or too long, or the producer is out of range");
+		_stats.sendErrors++;
+		UpdateTelemetry();
+		return false;
+	}
+
+	if (_queueEnabled)
+	{
+		return EnqueueFrame(telegram.GetData(), telegram.GetLength(), producer, callback, context);
+	}
+
+	Transmit(telegram.GetData(), telegram.GetLength(), 0);
+	_producers[producer].stats.telegramsSent++;
+	_producers[producer].stats.bytesSent += telegram.GetLength();
+	if (callback != nullptr)
+	{
+		callback(*this, true, context);
+	}
+	return true;
+}
+
+bool ArduinoIBIS::Port::CanSend(const Telegram* telegrams, uint8_t count, uint8_t producer) const
+{
+	if (_port == nullptr || producer >= IBIS_MAX_PRODUCERS)
+	{
+		return false;
+	}
+	if (!_queueEnabled)
+	{
+		return true;
+	}
+
+	const Producer& owner = _producers[producer];
+	if (_queueCount + count > IBIS_TX_QUEUE_SIZE || owner.count + count > owner.quota)
+	{
+		return false;
+	}
+
+	// Takes the blocks like FramePool::Allocate() would, on copies of the free blocks and the producer's blocks
+	uint8_t freeBlocks[IBIS_POOL_CLASSES];
+	uint8_t blocks[IBIS_POOL_CLASSES];
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		const FramePoolStatistics& stats = _framePool.GetStatistics(c);
+		freeBlocks[c] = stats.capacity - stats.inUse;
+		blocks[c] = owner.blocks[c];
+	}
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		uint8_t classes = GetAllowedClasses(owner, blocks);
+		uint8_t c = 0;
+		while (c < IBIS_POOL_CLASSES && (telegrams[i].GetLength() > _framePool.GetStatistics(c).blockSize ||
+			!(classes & (1 << c)) || freeBlocks[c] == 0))
+		{
+			c++;
+		}
+		if (c == IBIS_POOL_CLASSES)
+		{
+			return false;
+		}
+		freeBlocks[c]--;
+		blocks[c]++;
+	}
+	return true;
+}
+
+uint8_t ArduinoIBIS::Port::GetAllowedClasses(const Producer& owner, const uint8_t* blocks) const
+{
+	// The quota applies to the blocks of each size class as well
+	uint8_t classes = 0;
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		uint16_t capacity = _framePool.GetStatistics(c).capacity;
+		uint16_t limit = (capacity * owner.quota + IBIS_TX_QUEUE_SIZE - 1) / IBIS_TX_QUEUE_SIZE;
+		if (blocks[c] < limit)
+		{
+			classes |= 1 << c;
+		}
+	}
+	return classes;
+}
+
+bool ArduinoIBIS::Port::EnqueueFrame(const char* frame, uint16_t length, uint8_t producer, SendCallback callback, void* context)
+{
+	Producer& owner = _producers[producer];
+	char* block = nullptr;
+	if (_queueCount < IBIS_TX_QUEUE_SIZE && owner.count < owner.quota)
+	{
+		block = _framePool.Allocate(length, GetAllowedClasses(owner, owner.blocks));
+	}
+
+	if (block == nullptr)
+	{
+		if (_debug) _debugOutput->println("ArduinoIBIS: Cannot queue telegram, producer quota, queue or frame pool is full");
+		owner.stats.dropped++;
+		_stats.sendErrors++;
+		UpdateTelemetry();
+		return false;
+	}
+
+	memcpy(block, frame, length);
+	owner.blocks[_framePool.GetSizeClass(block)]++;
+
+	int8_t slot = 0;
+	while (_queue[slot].data != nullptr)
+	{
+		slot++;
+	}
+
+	// The frame starts when the producer's previous one is finished, or now if the producer was idle. Its finish tag
+	// is that plus its wire time (in bits) scaled by the weight, so producers with a higher weight advance slower and
+	// are picked more often
+	uint32_t start = (int32_t)(owner.lastFinish - _virtualTime) > 0 ? owner.lastFinish : _virtualTime;
+	owner.lastFinish = start + (uint32_t)length * 11 * 64 / owner.weight;
+
+	QueuedFrame& entry = _queue[slot];
+	entry.data = block;
+	entry.length = length;
+	entry.enqueuedAt = millis();
+	entry.finish = owner.lastFinish;
+	entry.producer = producer;
+	entry.next = -1;
+	entry.callback = callback;
+	entry.context = context;
+
+	if (owner.tail >= 0)
+	{
+		_queue[owner.tail].next = slot;
+	}
+	else
+	{
+		owner.head = slot;
+	}
+	owner.tail = slot;
+	owner.count++;
+	_queueCount++;
+	return true;
+}
+
+int8_t ArduinoIBIS::Port::GetNextQueued() const
+{
+	int8_t next = -1;
+	for (uint8_t i = 0; i < IBIS_MAX_PRODUCERS; i++)
+	{
+		int8_t head = _producers[i].head;
+		if (head >= 0 && (next < 0 || (int32_t)(_queue[head].finish - _queue[next].finish) < 0))
+		{
+			next = head;
+		}
+	}
+	return next;
+}
+
+void ArduinoIBIS::Port::TransmitQueued()
+{
+	if (_queueCount == 0)
+	{
 		return;
 	}
 
-	// German umlauts need to be handled: IBIS telegrams (and any text transmitted inside them) are plain in ASCII format,
-	// where umlauts are not part of. To fix this, the VDV 300 document uses a slightly altered ASCII table, which replaces
-	// a couple of never-used characters from the original ASCII tables with the german umlauts (see VDV 300 page 50).
-	// The replacement of any umlauts with the "real" ASCII values is happening here.
-	telegram.replace("ä", "{");
-	telegram.replace("ö", "|");
-	telegram.replace("ü", "}");
-	telegram.replace("ß", "~");
-	telegram.replace("Ä", "[");
-	telegram.replace("Ö", "\\");
-	telegram.replace("Ü", "]");
+	// Wait for a free slot between the bursts of the other master. Received bytes that weren't processed yet mean the
+	// bus is busy, and they'd come before the echo of our frame
+	int8_t slot = GetNextQueued();
+	if (_slotScheduling && _port != nullptr && (_port->available() > 0 || GetSlotWait(_queue[slot].length) > 0))
+	{
+		return;
+	}
+
+	QueuedFrame entry = _queue[slot];
+	_queue[slot].data = nullptr;
+	_virtualTime = entry.finish;
+	_queueCount--;
 
-	// Add a CR character at the end
-	telegram.concat('\x0d');
+	Producer& owner = _producers[entry.producer];
+	owner.head = entry.next;
+	if (owner.head < 0)
+	{
+		owner.tail = -1;
+	}
+	owner.count--;
 
-	// Calculate the telegram checksum by XOR-ing every byte, starting at 0x7F, and append it to the telegram
-	char checksum = 0x7F;
-	for (unsigned int i = 0; i < telegram.length(); i++)
+	if (_port != nullptr)
 	{
-		checksum ^= telegram[i];
+		uint32_t waitMs = millis() - entry.enqueuedAt;
+		Transmit(entry.data, entry.length, waitMs);
+		owner.stats.telegramsSent++;
+		owner.stats.bytesSent += entry.length;
+		if (waitMs > owner.stats.maxWaitMs)
+		{
+			owner.stats.maxWaitMs = waitMs;
+		}
 	}
-	telegram.concat(checksum);
+	owner.blocks[_framePool.GetSizeClass(entry.data)]--;
+	_framePool.Free(entry.data);
 
+	// Last, as the callback may send again (e.g. a resumed sequence)
+	if (entry.callback != nullptr)
+	{
+		entry.callback(*this, _port != nullptr, entry.context);
+	}
+}
+
+void ArduinoIBIS::Port::Transmit(const char* frame, uint16_t length, uint32_t waitMs)
+{
 	// Debug print the whole telegram
+	char checksum = frame[length - 1];
 	if (_debug)
 	{
 		_debugOutput->print("ArduinoIBIS: Sending telegram with length=");
-		_debugOutput->print(telegram.length());
+		_debugOutput->print(length);
 		_debugOutput->print(" checksum=0x");
 		if (checksum < 10)
 		{
@@ -212,37 +1054,131 @@ void ArduinoIBIS::Port::SendTelegram(String telegram)
 		_debugOutput->print(checksum, HEX);
 		_debugOutput->print(": ");
 
-		for (unsigned int i = 0; i < telegram.length(); i++)
+		for (uint16_t i = 0; i < length; i++)
 		{
-			if (telegram.charAt(i) < 0x10)
+			if (frame[i] < 0x10)
 			{
 				_debugOutput->print("0");
 			}
-			_debugOutput->print(telegram.charAt(i), HEX);
+			_debugOutput->print(frame[i], HEX);
 			_debugOutput->print(" ");
 		}
 		_debugOutput->println();
 	}
 
 	// Finally send the fully wrapped telegram through the serial port
-	_port->print(telegram);
+	uint64_t startMicros = 0;
+	if (_traceOutput != nullptr)
+	{
+		startMicros = GetTraceMicros();
+	}
+	uint32_t startMillis = millis();
+
+	_port->write((const uint8_t*)frame, length);
+	if (_slotScheduling)
+	{
+		_echoLength = length;
+		_echoPosition = 0;
+		memcpy(_echo, frame, length < sizeof(_echo) ? length : sizeof(_echo));
+	}
+
+	RecordSend(length, millis() - startMillis);
+	if (_captureCallback != nullptr)
+	{
+		_captureCallback((const uint8_t*)frame, (uint8_t)length, CaptureChecksumValid, _captureContext);
+	}
+	if (_traceOutput != nullptr)
+	{
+		TraceTelegram(frame, length, startMicros, (uint32_t)(GetTraceMicros() - startMicros), waitMs);
+	}
+}
+
+void ArduinoIBIS::Port::RecordSend(uint32_t length, uint32_t durationMs)
+{
+	_stats.telegramsSent++;
+	_stats.bytesSent += length;
+
+	uint8_t bucket = 0;
+	for (uint32_t limit = 32; bucket < IBIS_LATENCY_BUCKETS - 1 && durationMs >= limit; limit <<= 1)
+	{
+		bucket++;
+	}
+	_stats.latencyHistogram[bucket]++;
+
+	if (durationMs > _stats.maxLatencyMs)
+	{
+		_stats.maxLatencyMs = durationMs;
+	}
+
+	UpdateTelemetry();
 }
 
-String ArduinoIBIS::Port::ToHexString(uint8_t value)
+void ArduinoIBIS::Port::UpdateTelemetry()
 {
-	// The VDV 300 document describes how hex numbers should be encoded (page 50)
-	// Basically, the digits 0..9 are used as-is, and A..F is encoded by :;<=>? respectfully
-	static String hexCharacters = "0123456789:;<=>?";
-	String hexString;
+	if (_telemetryCallback == nullptr || millis() - _telemetryStart < _telemetryInterval)
+	{
+		return;
+	}
+
+	uint8_t record[IBIS_TELEMETRY_RECORD_SIZE];
+	uint8_t length = WriteTelemetryRecord(record);
+	_telemetryCallback(record, length, _telemetryContext);
 
-	uint8_t highNibble = value >> 4;
-	uint8_t lowNibble = value & 15;
+	// Start the next interval
+	_telemetryStart = millis();
+	_stats = Statistics();
+}
 
-	if (highNibble > 0)
+void ArduinoIBIS::Port::TraceTelegram(const char* frame, uint16_t length, uint64_t startMicros, uint32_t durationMicros, uint32_t waitMs)
+{
+	// The telegram type is the leading lower case letter, followed by an upper case sub type letter (if any)
+	char type[3] = { frame[0], '\0', '\0' };
+	if (length > 1 && frame[1] >= 'A' && frame[1] <= 'Z')
+	{
+		type[1] = frame[1];
+	}
+
+	// Telegrams starting with 'a' are addressed to a single device, the address directly follows the type
+	int address = -1;
+	if (type[0] == 'a' && length > 2)
+	{
+		address = frame[2] - '0';
+	}
+
+	// ts and dur are in microseconds, the 64 bit timestamp is split up as Print has no 64 bit overloads on all cores
+	char timestamp[24];
+	snprintf(timestamp, sizeof(timestamp), "%lu%06lu", (unsigned long)(startMicros / 1000000), (unsigned long)(startMicros % 1000000));
+	const char* ts = timestamp;
+	while (ts[0] == '0' && ts[1] != '\0')
+	{
+		ts++;
+	}
+
+	_traceOutput->print("{\"name\":\"");
+	_traceOutput->print(type);
+	_traceOutput->print("\",\"cat\":\"ibis\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":");
+	_traceOutput->print(ts);
+	_traceOutput->print(",\"dur\":");
+	_traceOutput->print(durationMicros);
+	_traceOutput->print(",\"args\":{\"type\":\"");
+	_traceOutput->print(type);
+	_traceOutput->print("\",\"address\":");
+	_traceOutput->print(address);
+	_traceOutput->print(",\"bytes\":");
+	_traceOutput->print(length);
+	_traceOutput->print(",\"queue_wait_ms\":");
+	_traceOutput->print(waitMs);
+	_traceOutput->println("}},");
+}
+
+uint64_t ArduinoIBIS::Port::GetTraceMicros()
+{
+	uint32_t now = micros();
+	if (now < _traceLastMicros)
 	{
-		hexString += hexCharacters.charAt(highNibble);
+		_traceMicrosHigh++;
 	}
+	_traceLastMicros = now;
 
-	hexString += hexCharacters.charAt(lowNibble);
-	return hexString;
+	return ((uint64_t)_traceMicrosHigh << 32) | now;
 }
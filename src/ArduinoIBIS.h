@@ -23,24 +23,204 @@
 
 #pragma once
 #include <SoftwareSerial.h>
+#include "ArduinoIBISFramePool.h"
+#include "ArduinoIBISTelegram.h"
+#include "ArduinoIBISFont.h"
+#include "ArduinoIBISCapture.h"
 
 // IBIS connection parameters (1200 7E2)
 #define IBIS_BAUD 1200
 #define IBIS_SERIAL_CONFIG SWSERIAL_7E2
 
 // Most telegrams don't have a complex structure and can therefore be constructed with a simple format string only
-// Hence, IBIS_SIMPLE_TELEGRAM can be used to declare those
-#define IBIS_TELEGRAM_BUFFER_SIZE 64
+// Hence, IBIS_SIMPLE_TELEGRAMS lists those, and is expanded with IBIS_SIMPLE_TELEGRAM to declare their encoders (see
+// Port::Build) and with IBIS_SEND_SIMPLE_TELEGRAM to declare the matching send functions on Port
+#define IBIS_SIMPLE_TELEGRAMS(X) \
+	X(001, uint16_t, "l%03d") /* Line Number, 1-3 digits */ \
+	X(001neu, uint16_t, "q%04d") /* Line number, alphanumeric, 1-4 chars */ \
+	X(001a, uint8_t, "lE%02d") /* Line number symbol, 1-2 digits */ \
+	X(001b, uint16_t, "lF%05d") /* Radio */ \
+	X(001c, uint16_t, "lP%03d") /* Line tape reel position ID, 1-3 digits */ \
+	X(001d, uint16_t, "lC%04d") /* Line number, alphanumeric, 1-4 chars */ \
+	X(001e, uint16_t, "lC%08d") /* Line number, alphanumeric, 1-8 chars */ \
+	X(001f, uint16_t, "lC%07d") /* Line number, alphanumeric, 1-7 chars */ \
+	X(002, uint8_t, "k%02d") /* Course number, 1-2 digits */ \
+	X(002a, uint16_t, "k%05d") /* Train number, 1-5 digits */ \
+	X(003, uint16_t, "z%03d") /* Destination text ID, 1-3 digits */ \
+	X(003b, uint16_t, "zR%03d") /* Destination ID for IMU, 1-3 digits */ \
+	X(003d, uint16_t, "zN%03d") /* Route number, 1-3 digits */ \
+	X(003e, uint16_t, "zP%03d") /* Destination tape reel position ID, 1-3 digits */ \
+	X(003f, uint16_t, "zN%06d") /* Route number, 1-6 digits */ \
+	X(003g, uint16_t, "zL%04d") /* Line number, 1-4 digits */ \
+	X(004, uint16_t, "e%06d") /* Ticket validator attributes, 6 digits */ \
+	X(004a, uint16_t, "eA%04d") /* Additional ticket validator attributes, 4 digits */ \
+	X(004b, uint16_t, "eH%07d") /* Ticket validator stop number, 1-7 digits */ \
+	X(005, uint16_t, "u%04d") /* Time, HHMM */ \
+	X(006, uint16_t, "d%05d") /* Date, DDMMY */ \
+	X(007, uint8_t, "w%01d") /* Train length, 1 digit */ \
+	X(009, const char*, "v%-16s") /* Next stop text, 16 chars */ \
+	X(009a, const char*, "v%-20s") /* Next stop text, 20 chars */ \
+	X(009b, const char*, "v%-24s") /* Next stop text, 24 chars */ \
+	X(010, uint16_t, "x%04d") /* Line progress display stop ID, 1-4 digits */ \
+	X(010a, uint16_t, "xH%04d") /* Line progress display stop ID, 1-4 digits */ \
+	X(010b, uint8_t, "xI%02d") /* Line progress display stop ID, 1-2 digits */ \
+	X(010d, uint16_t, "xJ%04d") /* Year, YYYY */
+
 #define IBIS_SIMPLE_TELEGRAM(id, argType, fmt) \
+	static Telegram DS##id(argType arg, const TextEncoding* encoding = nullptr) \
+	{ \
+		return Telegram::FormatField(encoding, fmt, arg); \
+	}
+
+#define IBIS_SEND_SIMPLE_TELEGRAM(id, argType, fmt) \
 	void DS##id(argType arg) \
 	{ \
-		char buf[IBIS_TELEGRAM_BUFFER_SIZE]; \
-		sprintf(buf, fmt, arg); \
-		SendTelegram(buf); \
+		Send(Build::DS##id(arg, _encoding)); \
 	}
 
+// Telemetry records are varint-encoded and never exceed this size (version byte plus 16 varints of at most 5 bytes)
+#define IBIS_TELEMETRY_VERSION 2
+#define IBIS_TELEMETRY_RECORD_SIZE 81
+#define IBIS_LATENCY_BUCKETS 8
+
+// Maximum number of timers that can be scheduled on a port at the same time
+#ifndef IBIS_MAX_TIMERS
+#define IBIS_MAX_TIMERS 8
+#endif
+
+// Returned by GetTimeUntilNextDeadline() when nothing is scheduled
+#define IBIS_NO_DEADLINE 0xFFFFFFFF
+
+// Number of telegrams the transmit queue can hold (their frames are stored in the frame pool)
+#ifndef IBIS_TX_QUEUE_SIZE
+#define IBIS_TX_QUEUE_SIZE 16
+#endif
+
+// Number of device addresses that can have a profile (IBIS addresses are a single hex digit)
+#ifndef IBIS_MAX_DEVICES
+#define IBIS_MAX_DEVICES 16
+#endif
+
+// Received telegrams longer than this are dropped. Run() processes at most IBIS_RX_BYTES_PER_RUN received bytes per
+// call, so a busy bus can't stall the loop
+#ifndef IBIS_RX_BUFFER_SIZE
+#define IBIS_RX_BUFFER_SIZE 64
+#endif
+#ifndef IBIS_RX_BYTES_PER_RUN
+#define IBIS_RX_BYTES_PER_RUN 16
+#endif
+
+// Polarity detection (see Polarity::Auto): the idle level of the RX pin is sampled IBIS_POLARITY_SAMPLES times, every
+// IBIS_POLARITY_SAMPLE_MICROS (shorter than a bit at 1200 baud, so a byte on the bus can't go unnoticed). Afterwards,
+// the polarity is confirmed by IBIS_POLARITY_VALID_FRAMES received frames with a valid checksum, and switched if
+// IBIS_POLARITY_TEST_BYTES bytes were received without any
+#ifndef IBIS_POLARITY_SAMPLES
+#define IBIS_POLARITY_SAMPLES 32
+#endif
+#ifndef IBIS_POLARITY_SAMPLE_MICROS
+#define IBIS_POLARITY_SAMPLE_MICROS 500
+#endif
+#ifndef IBIS_POLARITY_VALID_FRAMES
+#define IBIS_POLARITY_VALID_FRAMES 2
+#endif
+#ifndef IBIS_POLARITY_TEST_BYTES
+#define IBIS_POLARITY_TEST_BYTES 48
+#endif
+
+// Slot scheduling (see Port::SetSlotScheduling): received bytes less than IBIS_SLOT_BURST_GAP_MS apart belong to the
+// same burst of the other master (a byte takes about 9 ms at 1200 baud). Predictions are used once
+// IBIS_SLOT_MIN_CONFIDENCE bursts in a row matched the learned period
+#ifndef IBIS_SLOT_GUARD_MS
+#define IBIS_SLOT_GUARD_MS 20
+#endif
+#ifndef IBIS_SLOT_BURST_GAP_MS
+#define IBIS_SLOT_BURST_GAP_MS 30
+#endif
+#ifndef IBIS_SLOT_MIN_CONFIDENCE
+#define IBIS_SLOT_MIN_CONFIDENCE 3
+#endif
+
+// Number of producers sharing the transmit queue (see Port::SetProducer), producer 0 is the default
+#ifndef IBIS_MAX_PRODUCERS
+#define IBIS_MAX_PRODUCERS 4
+#endif
+
 namespace ArduinoIBIS
 {
+	// Counters aggregated over the current telemetry interval
+	struct Statistics
+	{
+		uint32_t telegramsSent = 0;
+		uint32_t bytesSent = 0;
+		uint32_t sendErrors = 0;
+
+		// Time spent sending a telegram, bucket 0 counts sends below 32ms, every further bucket doubles the limit,
+		// the last bucket counts everything from 2048ms upwards
+		uint32_t latencyHistogram[IBIS_LATENCY_BUCKETS] = {};
+		uint32_t maxLatencyMs = 0;
+
+		// Received telegrams with a valid checksum, and received telegrams that were dropped (bad checksum, too long)
+		uint32_t telegramsReceived = 0;
+		uint32_t receiveErrors = 0;
+
+		// Longest time a single Run() call took
+		uint32_t maxRunMicros = 0;
+	};
+
+	// Counters of a producer (see Port::SetProducer), they're never reset
+	struct ProducerStatistics
+	{
+		uint32_t telegramsSent = 0;
+		uint32_t bytesSent = 0;
+
+		// Telegrams dropped because the producer was over its quota, or the queue was full
+		uint32_t dropped = 0;
+
+		// Longest time a telegram of the producer waited in the queue
+		uint32_t maxWaitMs = 0;
+	};
+
+	class Port;
+
+	// Describes a device on the bus, so telegrams addressed to it can be tailored to it
+	struct DeviceProfile
+	{
+		// Text encoding of the device, e.g. with a charset for older signs. nullptr uses the port's encoding
+		const TextEncoding* encoding = nullptr;
+
+		// Font of the device and the width of its text area in pixels. The addressed telegram functions cut their texts
+		// to it, and it can be passed to Abbreviator::SetFont to abbreviate them instead. Without a font, width is the
+		// number of columns, 0 means texts aren't cut
+		const Font* font = nullptr;
+		uint16_t width = 0;
+	};
+
+	// Line polarity of the bus interface. Auto detects it: see Port::Begin()
+	enum class Polarity : uint8_t
+	{
+		Normal,
+		Inverted,
+		Auto
+	};
+
+	// Called by Port::Run() when a timer is due
+	typedef void (*TimerCallback)(Port& port, void* context);
+
+	// Called for received telegrams. The telegram is null-terminated and stripped of its CR and checksum.
+	// For response windows (see Port::ExpectResponse), telegram is nullptr if no response arrived in time
+	typedef void (*ReceiveCallback)(Port& port, const char* telegram, uint8_t length, void* context);
+
+	// Called once a telegram passed to Port::Send() with a callback is on the wire (sent is true), or was dropped from
+	// the transmit queue without being sent, e.g. by Port::End() (sent is false)
+	typedef void (*SendCallback)(Port& port, bool sent, void* context);
+
+	// Receives a finished telemetry record, ready to be passed to an uplink
+	typedef void (*TelemetryCallback)(const uint8_t* record, uint8_t length, void* context);
+
+	// Called for every frame sent or received, with the complete wire bytes (payload, CR, checksum) and CaptureFlags.
+	// It's called on the send path, so it must return quickly (see FlightRecorder)
+	typedef void (*CaptureCallback)(const uint8_t* frame, uint8_t length, uint8_t flags, void* context);
+
 	// This class acts as the main communication "port" handling an IBIS device.
 	// IBIS communication happens at 1288 baud in 7E2 configuration and is internally
 	// handled with a software serial interface, which is fine for slow baud rates like this.
@@ -48,10 +228,27 @@ namespace ArduinoIBIS
 	class Port
 	{
 	public:
+		// Ports can't be copied, as the queue points into the port's frame pool and timers and callbacks refer to it
+		Port() = default;
+		Port(const Port&) = delete;
+		Port& operator=(const Port&) = delete;
+
 		// Opens the IBIS serial port for communication
 		// Optionally, the IBIS signal can be inverted (might be required for certain hardware)
 		bool Begin(int8_t txPin = 12, int8_t rxPin = -1, bool invert = false);
 
+		// Opens the IBIS serial port with the given polarity. With Polarity::Auto, the idle level of the RX pin is
+		// sampled first (high = normal, low = inverted). If there's traffic on the bus while sampling, the port starts
+		// with normal polarity. Either way, Run() then test-decodes received frames and switches to the other polarity
+		// if nothing decodes, until frames with valid checksums confirm it. Without an RX pin, Auto means normal
+		bool Begin(int8_t txPin, int8_t rxPin, Polarity polarity);
+
+		// Returns the polarity in use
+		Polarity GetPolarity() const { return _polarity; }
+
+		// Whether Polarity::Auto has not been confirmed by received frames yet
+		bool IsDetectingPolarity() const { return _detectingPolarity; }
+
 		// Closes the IBIS serial port
 		void End();
 
@@ -59,68 +256,318 @@ namespace ArduinoIBIS
 		// initialized by you). Optionally, you can specify the output stream to print debug info to
 		void SetDebugOutput(bool enable, Stream* outputStream = &Serial);
 
+		// When enabled, telegrams are not sent right away but queued (in fixed frame pool blocks, no heap) and sent one
+		// by one from Run(). Telegrams are dropped and counted as send errors if the queue or pool is full
+		void SetQueueEnabled(bool enable);
+
+		// Returns the number of telegrams waiting in the transmit queue
+		uint8_t GetQueuedCount() const { return _queueCount; }
+
+		// Configures a producer, so components sending through the same port (e.g. route logic, clock, diagnostics) get
+		// their share of the bus. Every producer has its own queue, and the queued telegrams are sent by weighted fair
+		// queuing on their wire time: while several producers have telegrams waiting, each gets bus time in proportion
+		// to its weight, no matter how many telegrams the others queue. quota limits how many telegrams the producer can
+		// have queued (0 = the whole queue), so it can't take the queue slots of the others either. The same share of
+		// each frame pool size class (rounded up) is its limit there, so long texts can't use up the medium and large
+		// blocks the others need; telegrams over quota are dropped and counted as send errors. Fair queuing only
+		// applies to queued telegrams, so this enables the queue. Producer 0 is the default, with weight 1 and no quota
+		void SetProducer(uint8_t producer, uint8_t weight, uint8_t quota = 0);
+
+		// Selects the producer which sends the telegrams of the telegram functions and Send(telegram)
+		void SelectProducer(uint8_t producer) { _selectedProducer = producer; }
+		uint8_t GetSelectedProducer() const { return _selectedProducer; }
+
+		// Returns the statistics of a producer
+		const ProducerStatistics& GetProducerStatistics(uint8_t producer) const { return _producers[producer < IBIS_MAX_PRODUCERS ? producer : 0].stats; }
+
+		// Returns the frame pool backing the transmit queue, e.g. to check its exhaustion statistics
+		const FramePool& GetFramePool() const { return _framePool; }
+
+		// Coordinates with a second bus master (e.g. a ticketing controller) whose telegrams are seen on the RX pin.
+		// The port learns when the other master sends (its period and how long its bursts take) and holds queued
+		// telegrams back until they fit between its bursts, keeping guardMs away from them. While the other master is
+		// sending, nothing is sent anyway. Telegrams that can't fit between two bursts at all are sent without waiting.
+		// Only queued telegrams can wait for a slot, so this enables the queue
+		void SetSlotScheduling(bool enable, uint16_t guardMs = IBIS_SLOT_GUARD_MS);
+
+		// Returns the learned period of the other master in ms, or 0 while it's not known (well enough) yet
+		uint32_t GetMasterPeriod() const { return _slotConfidence >= IBIS_SLOT_MIN_CONFIDENCE ? _slotPeriod : 0; }
+
+		// Returns the learned duration of the other master's bursts in ms
+		uint32_t GetMasterBurstDuration() const { return _slotDuration; }
+
+		// When an output stream is given, every sent telegram is written to it as a Chrome trace event (JSON array format),
+		// which can be captured to a file and opened in Perfetto or chrome://tracing. Pass nullptr to stop tracing
+		void SetTraceOutput(Stream* outputStream);
+
+		// Every intervalMs, the statistics are encoded into a compact binary record, passed to the callback and reset.
+		// Pass a nullptr callback to disable telemetry. See tools/ibis_telemetry.py for the record layout and a decoder
+		void SetTelemetryCallback(uint32_t intervalMs, TelemetryCallback callback, void* context = nullptr);
+
+		// Sets the callback for capturing all sent and received frames, pass nullptr to stop capturing
+		void SetCaptureCallback(CaptureCallback callback, void* context = nullptr);
+
+		// Schedules the callback to be called by Run() after intervalMs, and every intervalMs after that if repeat is set.
+		// Returns a timer handle, or -1 if all IBIS_MAX_TIMERS timers are in use
+		int8_t AddTimer(uint32_t intervalMs, TimerCallback callback, void* context = nullptr, bool repeat = true);
+
+		// Cancels a timer returned by AddTimer()
+		void RemoveTimer(int8_t handle);
+
+		// Sets the callback for telegrams received on the RX pin (other masters, device responses)
+		void SetReceiveCallback(ReceiveCallback callback, void* context = nullptr);
+
+		// Opens a response window: the next telegram received within timeoutMs is passed to the callback instead of the
+		// receive callback. If nothing arrives in time, the callback is called with a nullptr telegram.
+		// Only one window can be open, opening a new one closes the previous one as if it had timed out. The previous
+		// callback is called after the new window is open, so if it opens a window again, that closes the new one
+		void ExpectResponse(uint32_t timeoutMs, ReceiveCallback callback, void* context = nullptr);
+
+		// The event loop of the port: processes received bytes, closes expired response windows and runs everything
+		// else that is due (timers, telemetry). Work per call is bounded. Call this from loop()
+		void Run();
+
+		// Returns how long the last Run() call took, in microseconds
+		uint32_t GetLastRunMicros() const { return _lastRunMicros; }
+
+		// Returns the number of milliseconds until Run() has to be called next, or IBIS_NO_DEADLINE if nothing is
+		// scheduled. Applications can sleep for this long instead of polling Run() all the time
+		uint32_t GetTimeUntilNextDeadline() const;
+
+		// Returns the statistics of the current telemetry interval
+		const Statistics& GetStatistics() const { return _stats; }
+
+		// Encodes the current statistics into a telemetry record and returns its length
+		uint8_t WriteTelemetryRecord(uint8_t (&record)[IBIS_TELEMETRY_RECORD_SIZE]) const;
+
+	public:
+		// Encoders, building telegrams without sending them (see Telegram). Text arguments are UTF-8 and transcoded with
+		// the given encoding (built-in transliteration only if nullptr)
+		struct Build
+		{
+			// Simple telegram declarations
+			IBIS_SIMPLE_TELEGRAMS(IBIS_SIMPLE_TELEGRAM)
+
+			// Extended telegram declarations
+			static Telegram DS010e(const char* sign, uint16_t delay); // Delay, sign is either '+' or '-', delay is 1-3 digits
+
+			static Telegram DS003a(const char* text, const TextEncoding* encoding = nullptr); // Destination text
+			static Telegram DS003c(const char* text, const TextEncoding* encoding = nullptr); // Next stop name
+
+			static Telegram DS021(uint8_t address, const char* text, const TextEncoding* encoding = nullptr); // Destination text
+			static Telegram DS021a(uint8_t address, uint8_t stopId, const char* stopText, const char* changeText, const TextEncoding* encoding = nullptr); // Line progress display text
+
+			static Telegram GSP(uint8_t address, const char* line1, const char* line2, const TextEncoding* encoding = nullptr);
+		};
+
+		// Sets the text encoding used by the telegram functions below, e.g. to add overrides for characters the
+		// connected displays show differently. The encoding has to stay alive while it's set
+		void SetTextEncoding(const TextEncoding* encoding) { _encoding = encoding; }
+		const TextEncoding* GetTextEncoding() const { return _encoding; }
+
+		// Sets the profile of the device with the given address, which is used by the addressed telegram functions
+		// (DS021, DS021a, GSP) for its encoding and to cut texts to its width. Pass nullptr to remove it. The profile has
+		// to stay alive while it's set
+		void SetDeviceProfile(uint8_t address, const DeviceProfile* profile);
+
+		// Returns the text encoding used for the device with the given address
+		const TextEncoding* GetEncoding(uint8_t address) const;
+
+		// Sends a telegram built with Port::Build (or puts it into the transmit queue, see SetQueueEnabled), for the
+		// selected producer or the given one. Returns false if the telegram was neither sent nor queued
+		bool Send(const Telegram& telegram) { return Send(telegram, _selectedProducer); }
+		bool Send(const Telegram& telegram, uint8_t producer) { return Send(telegram, producer, nullptr, nullptr); }
+
+		// Like Send(), but calls the callback once the telegram is on the wire or was dropped from the queue. Without
+		// the queue, that's before this returns. The callback is only called if this returns true
+		bool Send(const Telegram& telegram, uint8_t producer, SendCallback callback, void* context);
+
+		// Whether Send() would take all of the telegrams for the producer right now: there are enough queue slots, the
+		// producer's quota allows them and the frame pool has blocks for them. Lets a set of telegrams be queued all or
+		// none
+		bool CanSend(const Telegram* telegrams, uint8_t count, uint8_t producer) const;
+
 	public:
 		// Simple telegram declarations
-		IBIS_SIMPLE_TELEGRAM(001, uint16_t, "l%03d"); // Line Number, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(001neu, uint16_t, "q%04d"); // Line number, alphanumeric, 1-4 chars
-		IBIS_SIMPLE_TELEGRAM(001a, uint8_t, "lE%02d"); // Line number symbol, 1-2 digits
-		IBIS_SIMPLE_TELEGRAM(001b, uint16_t, "lF%05d"); // Radio
-		IBIS_SIMPLE_TELEGRAM(001c, uint16_t, "lP%03d"); // Line tape reel position ID, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(001d, uint16_t, "lC%04d"); // Line number, alphanumeric, 1-4 chars
-		IBIS_SIMPLE_TELEGRAM(001e, uint16_t, "lC%08d"); // Line number, alphanumeric, 1-8 chars
-		IBIS_SIMPLE_TELEGRAM(001f, uint16_t, "lC%07d"); // Line number, alphanumeric, 1-7 chars
-		IBIS_SIMPLE_TELEGRAM(002, uint8_t, "k%02d"); // Course number, 1-2 digits
-		IBIS_SIMPLE_TELEGRAM(002a, uint16_t, "k%05d"); // Train number, 1-5 digits
-		IBIS_SIMPLE_TELEGRAM(003, uint16_t, "z%03d"); // Destination text ID, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(003b, uint16_t, "zR%03d"); // Destination ID for IMU, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(003d, uint16_t, "zN%03d"); // Route number, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(003e, uint16_t, "zP%03d"); // Destination tape reel position ID, 1-3 digits
-		IBIS_SIMPLE_TELEGRAM(003f, uint16_t, "zN%06d"); // Route number, 1-6 digits
-		IBIS_SIMPLE_TELEGRAM(003g, uint16_t, "zL%04d"); // Line number, 1-4 digits
-
-		IBIS_SIMPLE_TELEGRAM(004, uint16_t, "e%06d"); // Ticket validator attributes, 6 digits
-		IBIS_SIMPLE_TELEGRAM(004a, uint16_t, "eA%04d"); // Additional ticket validator attributes, 4 digits
-		IBIS_SIMPLE_TELEGRAM(004b, uint16_t, "eH%07d"); // Ticket validator stop number, 1-7 digits
-
-		IBIS_SIMPLE_TELEGRAM(005, uint16_t, "u%04d"); // Time, HHMM
-		IBIS_SIMPLE_TELEGRAM(006, uint16_t, "d%05d"); // Date, DDMMY
-
-		IBIS_SIMPLE_TELEGRAM(007, uint8_t, "w%01d"); // Train length, 1 digit
-
-		IBIS_SIMPLE_TELEGRAM(009, const char*, "v%-16s"); // Next stop text, 16 chars
-		IBIS_SIMPLE_TELEGRAM(009a, const char*, "v%-20s"); // Next stop text, 20 chars
-		IBIS_SIMPLE_TELEGRAM(009b, const char*, "v%-24s"); // Next stop text, 24 chars
-
-		IBIS_SIMPLE_TELEGRAM(010, uint16_t, "x%04d"); // Line progress display stop ID, 1-4 digits
-		IBIS_SIMPLE_TELEGRAM(010a, uint16_t, "xH%04d"); // Line progress display stop ID, 1-4 digits
-		IBIS_SIMPLE_TELEGRAM(010b, uint8_t, "xI%02d"); // Line progress display stop ID, 1-2 digits
-		IBIS_SIMPLE_TELEGRAM(010d, uint16_t, "xJ%04d"); // Year, YYYY
+		IBIS_SIMPLE_TELEGRAMS(IBIS_SEND_SIMPLE_TELEGRAM)
 
 	public:
 		// Extended telegram declarations
-		void DS010e(const char* sign, uint16_t delay); // Delay, sign is either '+' or '-', delay is 1-3 digits
+		void DS010e(const char* sign, uint16_t delay) { Send(Build::DS010e(sign, delay)); }
 
-		void DS003a(const String& text); // Destination text
-		void DS003c(const String& text); // Next stop name
+		void DS003a(const String& text) { Send(Build::DS003a(text.c_str(), _encoding)); }
+		void DS003c(const String& text) { Send(Build::DS003c(text.c_str(), _encoding)); }
 
-		void DS021(uint8_t address, String text); // Destination text
-		void DS021a(uint8_t address, uint8_t stopId, String stopText, String changeText); // Line progress display text
+		void DS021(uint8_t address, String text);
+		void DS021a(uint8_t address, uint8_t stopId, String stopText, String changeText);
 
 		void GSP(uint8_t address, String line1, String line2);
 
 	private:
-		// Wraps the telegram with the required extra data and sends it to the serial port
-		void SendTelegram(String telegram);
+		// Returns the text cut to the width in the profile of the device with the given address, using buffer if it has
+		// to be cut
+		const char* FitToDevice(uint8_t address, const char* text, char* buffer, uint16_t size) const;
+
+		// Copies a wrapped frame into the transmit queue of a producer. Returns false if it was dropped
+		bool EnqueueFrame(const char* frame, uint16_t length, uint8_t producer, SendCallback callback, void* context);
+
+		// Returns the slot of the queued frame to send next (the one with the earliest finish tag), or -1
+		int8_t GetNextQueued() const;
+
+		// Sends the next queued frame, if any
+		void TransmitQueued();
 
-		// Converts a uint8 value to a VDV hex string
-		static String ToHexString(uint8_t value);
+		// Writes a wrapped frame to the serial port and accounts for it in the statistics and trace
+		void Transmit(const char* frame, uint16_t length, uint32_t waitMs);
+
+		// Writes a single trace event for a frame that took the given amount of microseconds to transmit
+		void TraceTelegram(const char* frame, uint16_t length, uint64_t startMicros, uint32_t durationMicros, uint32_t waitMs);
+
+		// Adds a finished send to the statistics and emits a telemetry record when the interval has elapsed
+		void RecordSend(uint32_t length, uint32_t durationMs);
+		void UpdateTelemetry();
+
+		// Creates and opens the software serial port
+		bool OpenSerial(bool invert);
+
+		// Samples the idle level of the RX pin. Returns Auto if the level changed (there's traffic on the bus)
+		Polarity SampleIdlePolarity() const;
+
+		// Switches to the other polarity if received bytes didn't decode, called from Run() while detecting
+		void UpdatePolarityDetection();
+
+		// Learns the timing of the other master from a byte received at the given time
+		void ObserveBusByte(uint8_t value, uint32_t now);
+
+		// Returns how many ms a frame of the given length has to wait for a free slot, 0 if it can be sent now
+		uint32_t GetSlotWait(uint16_t length) const;
+
+		// Feeds a received byte into the receive state machine
+		void ReceiveByte(uint8_t value);
+
+		// Hands a received telegram to the response window or receive callback
+		void DispatchReceived(const char* telegram, uint8_t length);
+
+		// Returns micros() extended to 64 bit, so traces covering many hours don't wrap around
+		uint64_t GetTraceMicros();
 
 	private:
 		// Internal handle to the software serial port
 		EspSoftwareSerial::UART* _port = nullptr;
+		int8_t _txPin = -1;
+		int8_t _rxPin = -1;
+
+		// Polarity in use and the state of its detection
+		Polarity _polarity = Polarity::Normal;
+		bool _detectingPolarity = false;
+		uint8_t _detectValidFrames = 0;
+		uint16_t _detectBytes = 0;
+
+		// Text encoding used by the telegram functions, and the profiles of the devices by address
+		const TextEncoding* _encoding = nullptr;
+		const DeviceProfile* _devices[IBIS_MAX_DEVICES] = {};
 
 		// Whether to print debug output
 		bool _debug = false;
 		Stream* _debugOutput = nullptr;
+
+		// Transmit queue: slots of frames allocated from the frame pool (free slots have no data), linked into a list
+		// per producer
+		struct QueuedFrame
+		{
+			char* data = nullptr;
+			uint16_t length = 0;
+			uint32_t enqueuedAt = 0;
+
+			// Virtual time at which the frame is finished, if its producer got exactly its share of the bus
+			uint32_t finish = 0;
+			uint8_t producer = 0;
+			int8_t next = -1;
+
+			// Called once the frame is sent or dropped
+			SendCallback callback = nullptr;
+			void* context = nullptr;
+		};
+		bool _queueEnabled = false;
+		QueuedFrame _queue[IBIS_TX_QUEUE_SIZE];
+		uint8_t _queueCount = 0;
+		FramePool _framePool;
+
+		// Producers and the virtual time of the fair queuing, which is the finish tag of the frame sent last
+		// (self-clocked fair queuing)
+		struct Producer
+		{
+			uint8_t weight = 1;
+			uint8_t quota = IBIS_TX_QUEUE_SIZE;
+			int8_t head = -1;
+			int8_t tail = -1;
+			uint8_t count = 0;
+			uint8_t blocks[IBIS_POOL_CLASSES] = {};
+			uint32_t lastFinish = 0;
+			ProducerStatistics stats;
+		};
+		Producer _producers[IBIS_MAX_PRODUCERS];
+		uint8_t _selectedProducer = 0;
+		uint32_t _virtualTime = 0;
+
+		// Returns the frame pool size classes a producer may still take a block from (bit 0 = small), given the blocks it
+		// holds in each class
+		uint8_t GetAllowedClasses(const Producer& owner, const uint8_t* blocks) const;
+
+		// Trace output stream (if any) and state to extend micros() beyond its 32 bit wrap around
+		Stream* _traceOutput = nullptr;
+		uint32_t _traceLastMicros = 0;
+		uint32_t _traceMicrosHigh = 0;
+
+		// A timer slot used by AddTimer()
+		struct Timer
+		{
+			uint32_t due = 0;
+			uint32_t interval = 0;
+			TimerCallback callback = nullptr;
+			void* context = nullptr;
+			bool repeat = false;
+		};
+		Timer _timers[IBIS_MAX_TIMERS];
+
+		// Receive state. A telegram is complete with the byte following its CR, which is the checksum. The buffer has
+		// room for the CR and checksum, so the complete frame can be captured
+		char _rxBuffer[IBIS_RX_BUFFER_SIZE + 1];
+		uint8_t _rxLength = 0;
+		bool _rxAwaitingChecksum = false;
+		bool _rxOverflow = false;
+		ReceiveCallback _receiveCallback = nullptr;
+		void* _receiveContext = nullptr;
+
+		// Response window opened with ExpectResponse()
+		ReceiveCallback _responseCallback = nullptr;
+		void* _responseContext = nullptr;
+		uint32_t _responseDeadline = 0;
+
+		uint32_t _lastRunMicros = 0;
+
+		// Slot scheduling state: the learned period and burst duration of the other master, when its current (or last)
+		// burst started and its last byte was received, and the start of our last frame to recognize its echo
+		bool _slotScheduling = false;
+		uint16_t _slotGuard = IBIS_SLOT_GUARD_MS;
+		bool _slotSeen = false;
+		uint8_t _slotConfidence = 0;
+		uint32_t _slotPeriod = 0;
+		uint32_t _slotDuration = 0;
+		uint32_t _slotBurstStart = 0;
+		uint32_t _slotLastByte = 0;
+		char _echo[16];
+		uint16_t _echoLength = 0;
+		uint16_t _echoPosition = 0;
+
+		// Statistics and telemetry interval state
+		Statistics _stats;
+		TelemetryCallback _telemetryCallback = nullptr;
+		void* _telemetryContext = nullptr;
+		uint32_t _telemetryInterval = 0;
+		uint32_t _telemetryStart = 0;
+
+		CaptureCallback _captureCallback = nullptr;
+		void* _captureContext = nullptr;
 	};
 }
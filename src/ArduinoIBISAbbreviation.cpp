@@ -0,0 +1,184 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISAbbreviation.h"
+
+// The most specific entries come first, so "Zentraler Omnibusbahnhof" becomes "ZOB" and not "Zentraler Busbf"
+const ArduinoIBIS::Abbreviation ArduinoIBIS::Abbreviations::German[] =
+{
+	{ "Zentraler Omnibusbahnhof", "ZOB" },
+	{ "Hauptbahnhof", "Hbf" },
+	{ "Busbahnhof", "Busbf" },
+	{ "Bahnhof", "Bf" },
+	{ "Straße", "Str." },
+	{ "Strasse", "Str." },
+	{ "straße", "str." },
+	{ "strasse", "str." },
+	{ "Platz", "Pl." },
+	{ "platz", "pl." },
+	{ "Krankenhaus", "Krhs." },
+	{ "Friedhof", "Friedh." },
+	{ "Flughafen", "Flugh." },
+	{ "Universität", "Uni" },
+	{ "Schule", "Sch." },
+	{ "Sankt ", "St. " },
+};
+const uint8_t ArduinoIBIS::Abbreviations::GermanCount = sizeof(German) / sizeof(German[0]);
+
+// Replaces every occurrence of from by to, in place. Returns the new length
+static uint8_t ReplaceAll(char* text, uint8_t length, const char* from, const char* to)
+{
+	uint8_t fromLength = strlen(from);
+	uint8_t toLength = strlen(to);
+	if (fromLength == 0 || toLength > fromLength)
+	{
+		// Abbreviations only ever make texts shorter, which allows replacing in place
+		return length;
+	}
+
+	char* match = text;
+	while ((match = strstr(match, from)) != nullptr)
+	{
+		memmove(match + toLength, match + fromLength, length - (match - text) - fromLength + 1);
+		memcpy(match, to, toLength);
+		length -= fromLength - toLength;
+		match += toLength;
+	}
+
+	return length;
+}
+
+ArduinoIBIS::Abbreviator::Abbreviator(const Abbreviation* dictionary, uint8_t count)
+	: _dictionary(dictionary), _count(count)
+{
+}
+
+void ArduinoIBIS::Abbreviator::SetFont(const Font* font, const TextEncoding* encoding)
+{
+	_font = font;
+	_encoding = encoding;
+
+	for (uint8_t i = 0; i < IBIS_ABBREVIATION_CACHE_SIZE; i++)
+	{
+		_cache[i].used = false;
+	}
+}
+
+uint16_t ArduinoIBIS::Abbreviator::Measure(const char* text) const
+{
+	if (_font != nullptr)
+	{
+		char encoded[IBIS_ABBREVIATION_MAX_LENGTH];
+		uint16_t length = TranscodeText(text, encoded, sizeof(encoded), _encoding);
+		return MeasureText(*_font, encoded, length);
+	}
+
+	// Every byte that doesn't continue a UTF-8 sequence starts a new character
+	uint16_t columns = 0;
+	for (; *text != '\0'; text++)
+	{
+		if ((*text & 0xC0) != 0x80)
+		{
+			columns++;
+		}
+	}
+
+	return columns;
+}
+
+uint8_t ArduinoIBIS::Abbreviator::Fit(const char* text, uint16_t width, char* out, uint8_t outSize) const
+{
+	if (outSize == 0)
+	{
+		return 0;
+	}
+
+	// Work on a copy, cut at a character boundary if it doesn't fit the buffer
+	uint8_t length = strlen(text) < (size_t)(outSize - 1) ? strlen(text) : outSize - 1;
+	while (length > 0 && (text[length] & 0xC0) == 0x80)
+	{
+		length--;
+	}
+	memcpy(out, text, length);
+	out[length] = '\0';
+
+	// The text only needs to be measured again if an abbreviation matched
+	uint16_t measured = Measure(out);
+	for (uint8_t i = 0; i < _count && measured > width; i++)
+	{
+		uint8_t shortened = ReplaceAll(out, length, _dictionary[i].longForm, _dictionary[i].shortForm);
+		if (shortened != length)
+		{
+			length = shortened;
+			measured = Measure(out);
+		}
+	}
+
+	// Still too long, cut it after the last character that fits
+	if (measured > width)
+	{
+		length = FitUTF8Text(_font, _encoding, out, length, width);
+		out[length] = '\0';
+	}
+
+	// Don't leave a dangling space where the text was cut or an abbreviation ended
+	while (length > 0 && out[length - 1] == ' ')
+	{
+		length--;
+	}
+
+	out[length] = '\0';
+	return length;
+}
+
+const char* ArduinoIBIS::Abbreviator::Fit(const char* text, uint16_t width)
+{
+	// Only the part of the text Fit() works on matters, which keeps the stored copy bounded. FNV-1a
+	uint32_t hash = 2166136261u;
+	uint8_t length = 0;
+	for (const char* c = text; *c != '\0' && length < IBIS_ABBREVIATION_MAX_LENGTH - 1; c++, length++)
+	{
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+
+	for (uint8_t i = 0; i < IBIS_ABBREVIATION_CACHE_SIZE; i++)
+	{
+		const CacheEntry& entry = _cache[i];
+		if (entry.used && entry.hash == hash && entry.length == length && entry.width == width && memcmp(entry.text, text, length) == 0)
+		{
+			return entry.result;
+		}
+	}
+
+	// Not cached yet, replace the oldest entry
+	CacheEntry& entry = _cache[_nextEntry];
+	_nextEntry = (_nextEntry + 1) % IBIS_ABBREVIATION_CACHE_SIZE;
+
+	entry.hash = hash;
+	entry.length = length;
+	memcpy(entry.text, text, length);
+	entry.width = width;
+	entry.used = true;
+	Fit(text, width, entry.result, sizeof(entry.result));
+	return entry.result;
+}
@@ -0,0 +1,101 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <Arduino.h>
+#include "ArduinoIBISFont.h"
+
+// Longest text (in bytes, UTF-8) the abbreviator works with, longer texts are cut before abbreviating
+#ifndef IBIS_ABBREVIATION_MAX_LENGTH
+#define IBIS_ABBREVIATION_MAX_LENGTH 64
+#endif
+
+// Number of fitted texts the abbreviator remembers
+#ifndef IBIS_ABBREVIATION_CACHE_SIZE
+#define IBIS_ABBREVIATION_CACHE_SIZE 8
+#endif
+
+namespace ArduinoIBIS
+{
+	// A dictionary entry, replacing every occurrence of longForm by shortForm
+	struct Abbreviation
+	{
+		const char* longForm;
+		const char* shortForm;
+	};
+
+	// Built-in dictionaries
+	namespace Abbreviations
+	{
+		// Common German stop name parts (Hauptbahnhof -> Hbf, Straße -> Str.)
+		extern const Abbreviation German[];
+		extern const uint8_t GermanCount;
+	}
+
+	// Shortens texts to fit displays with a fixed number of columns (e.g. 16 for DS009, 20 for DS009a), or a fixed
+	// width in pixels when a font is set. Abbreviations are applied in dictionary order, one entry at a time, until the
+	// text fits, so put the ones that hurt readability least first. If the text still doesn't fit, it's cut.
+	// Without a font, widths are counted in characters, so an umlaut counts as one column
+	class Abbreviator
+	{
+	public:
+		Abbreviator(const Abbreviation* dictionary, uint8_t count);
+
+		// Measures texts in pixels of the given font (after transcoding them with the encoding) instead of characters.
+		// Clears the cache, as the results depend on the font
+		void SetFont(const Font* font, const TextEncoding* encoding = nullptr);
+
+		// Returns the text fitted to width columns (or pixels). Results are memoised per (text, width), so calling this on every
+		// stop change only does the work once per stop. The returned pointer stays valid until the cache entry is
+		// reused (after IBIS_ABBREVIATION_CACHE_SIZE other texts)
+		const char* Fit(const char* text, uint16_t width);
+
+		// Fits the text into out (null-terminated) without using the cache, e.g. to precompute all texts of a route
+		// once. Returns the length of the fitted text in bytes
+		uint8_t Fit(const char* text, uint16_t width, char* out, uint8_t outSize) const;
+
+		// Returns the width of the text in columns (or pixels, if a font is set)
+		uint16_t Measure(const char* text) const;
+
+	private:
+		struct CacheEntry
+		{
+			// The input text, as far as Fit() reads it (IBIS_ABBREVIATION_MAX_LENGTH - 1 bytes). The FNV-1a hash only
+			// rules out most entries quickly, a hit is confirmed by comparing the text
+			uint32_t hash = 0;
+			uint8_t length = 0;
+			uint16_t width = 0;
+			bool used = false;
+			char text[IBIS_ABBREVIATION_MAX_LENGTH - 1];
+			char result[IBIS_ABBREVIATION_MAX_LENGTH];
+		};
+
+		const Abbreviation* _dictionary;
+		uint8_t _count;
+		const Font* _font = nullptr;
+		const TextEncoding* _encoding = nullptr;
+
+		CacheEntry _cache[IBIS_ABBREVIATION_CACHE_SIZE];
+		uint8_t _nextEntry = 0;
+	};
+}
@@ -0,0 +1,148 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISCapture.h"
+#include <string.h>
+
+int8_t ArduinoIBIS::GetCaptureAddress(const uint8_t* frame, uint8_t length)
+{
+	// Addressed telegrams are a, sub type letter, address as VDV hex digit (0..9, :..?)
+	if (length < 3 || frame[0] != 'a' || frame[2] < '0' || frame[2] > '?')
+	{
+		return -1;
+	}
+	return frame[2] - '0';
+}
+
+bool ArduinoIBIS::CaptureBlockMayContain(const CaptureBlockHeader& header, char type, int8_t address)
+{
+	uint8_t character = type & 0x7F;
+	if (!(header.types[character >> 3] & (1 << (character & 7))))
+	{
+		return false;
+	}
+	return address < 0 || (header.addresses & (1 << address));
+}
+
+uint32_t ArduinoIBIS::GetCaptureDataOffset(const CaptureFileHeader& header)
+{
+	return header.version >= 2 ? header.blockSize : sizeof(CaptureFileHeader);
+}
+
+bool ArduinoIBIS::IsCaptureBlockIntact(const CaptureBlockHeader& header)
+{
+	return header.magic == IBIS_CAPTURE_BLOCK_MAGIC && header.usedBytes <= IBIS_CAPTURE_BLOCK_SIZE - sizeof(CaptureBlockHeader);
+}
+
+bool ArduinoIBIS::ReadCaptureRecord(const uint8_t* block, const CaptureBlockHeader& header, uint16_t& offset, CaptureRecord& record)
+{
+	// usedBytes comes from storage, so it's bounded by the block
+	uint16_t usedBytes = header.usedBytes;
+	if (usedBytes > IBIS_CAPTURE_BLOCK_SIZE - sizeof(CaptureBlockHeader))
+	{
+		usedBytes = IBIS_CAPTURE_BLOCK_SIZE - sizeof(CaptureBlockHeader);
+	}
+
+	if (offset + IBIS_CAPTURE_RECORD_HEADER_SIZE > usedBytes)
+	{
+		return false;
+	}
+
+	const uint8_t* data = block + sizeof(CaptureBlockHeader) + offset;
+	CaptureRecordHeader recordHeader;
+	memcpy(&recordHeader.timeOffset, data, 4);
+	recordHeader.flags = data[4];
+	recordHeader.length = data[5];
+
+	if (offset + IBIS_CAPTURE_RECORD_HEADER_SIZE + recordHeader.length > usedBytes)
+	{
+		return false;
+	}
+
+	record.time = header.firstTime + recordHeader.timeOffset;
+	record.flags = recordHeader.flags;
+	record.length = recordHeader.length;
+	record.frame = data + IBIS_CAPTURE_RECORD_HEADER_SIZE;
+	offset += IBIS_CAPTURE_RECORD_HEADER_SIZE + recordHeader.length;
+	return true;
+}
+
+ArduinoIBIS::CaptureBlock::CaptureBlock(uint8_t* buffer)
+	: _buffer(buffer)
+{
+	Reset();
+}
+
+void ArduinoIBIS::CaptureBlock::Reset()
+{
+	memset(&_header, 0, sizeof(_header));
+	_header.magic = IBIS_CAPTURE_BLOCK_MAGIC;
+	memset(_buffer, 0, IBIS_CAPTURE_BLOCK_SIZE);
+}
+
+bool ArduinoIBIS::CaptureBlock::Append(uint64_t time, uint8_t flags, const uint8_t* frame, uint8_t length)
+{
+	uint16_t recordSize = IBIS_CAPTURE_RECORD_HEADER_SIZE + length;
+	if (sizeof(CaptureBlockHeader) + _header.usedBytes + recordSize > IBIS_CAPTURE_BLOCK_SIZE)
+	{
+		return false;
+	}
+
+	if (_header.recordCount == 0)
+	{
+		_header.firstTime = time;
+	}
+	else if (time < _header.firstTime || time - _header.firstTime > 0xFFFFFFFF)
+	{
+		return false;
+	}
+
+	uint32_t timeOffset = (uint32_t)(time - _header.firstTime);
+	uint8_t* data = _buffer + sizeof(CaptureBlockHeader) + _header.usedBytes;
+	memcpy(data, &timeOffset, 4);
+	data[4] = flags;
+	data[5] = length;
+	memcpy(data + IBIS_CAPTURE_RECORD_HEADER_SIZE, frame, length);
+
+	if (length > 0)
+	{
+		uint8_t character = frame[0] & 0x7F;
+		_header.types[character >> 3] |= 1 << (character & 7);
+	}
+	int8_t address = GetCaptureAddress(frame, length);
+	if (address >= 0)
+	{
+		_header.addresses |= 1 << address;
+	}
+
+	_header.lastTime = time;
+	_header.usedBytes += recordSize;
+	_header.recordCount++;
+	return true;
+}
+
+const uint8_t* ArduinoIBIS::CaptureBlock::Finish()
+{
+	memcpy(_buffer, &_header, sizeof(_header));
+	return _buffer;
+}
@@ -0,0 +1,153 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// On-disk format for bus captures, shared by the target and the host tools (see tools/ibis_capture.cpp). All numbers
+// are little endian.
+//
+// A capture file is a CaptureFileHeader, padded with zeros to IBIS_CAPTURE_BLOCK_SIZE, followed by blocks of that size
+// (version 1 files have no padding). Blocks stay aligned with flash blocks of the same size, so appending one never
+// copies a partly filled one on a flash file system. Every block
+// starts with a CaptureBlockHeader which holds the time span of its records and bitmaps of the telegram types and
+// addresses in it. As blocks have a fixed size, the headers form a sparse index: a reader finds a point in time with
+// a binary search over the block headers and skips blocks without the wanted telegrams, without reading their records.
+// After the header, records are packed back to back: a CaptureRecordHeader followed by the frame bytes (payload, CR
+// and checksum). The rest of the block is zero
+#define IBIS_CAPTURE_MAGIC "IBISCAP1"
+#define IBIS_CAPTURE_VERSION 2
+#define IBIS_CAPTURE_BLOCK_MAGIC 0x4B4C4249 // "IBLK"
+
+// Size of a record header on disk (CaptureRecordHeader without padding)
+#define IBIS_CAPTURE_RECORD_HEADER_SIZE 6
+
+#ifndef IBIS_CAPTURE_BLOCK_SIZE
+#define IBIS_CAPTURE_BLOCK_SIZE 4096
+#endif
+
+namespace ArduinoIBIS
+{
+	// Record flags
+	enum CaptureFlags : uint8_t
+	{
+		// The frame was received (or observed on the bus), otherwise it was sent by this device
+		CaptureReceived = 0x01,
+
+		// The checksum of the frame was correct
+		CaptureChecksumValid = 0x02
+	};
+
+	struct CaptureFileHeader
+	{
+		char magic[8];
+		uint16_t version;
+		uint16_t blockSize;
+
+		// Position of the file in a ring of segment files (see FlightRecorder), 0 for standalone captures
+		uint32_t sequence;
+	};
+
+	struct CaptureBlockHeader
+	{
+		uint32_t magic;
+		uint16_t recordCount;
+
+		// Bytes of records after the header
+		uint16_t usedBytes;
+
+		// Time of the first and last record in microseconds. On the host this is UNIX time, on the target whatever
+		// clock the application provides
+		uint64_t firstTime;
+		uint64_t lastTime;
+
+		// One bit per leading telegram character (0..127), and one bit per address of addressed telegrams
+		uint8_t types[16];
+		uint16_t addresses;
+
+		uint8_t reserved[6];
+	};
+
+	struct CaptureRecordHeader
+	{
+		// Microseconds since the firstTime of the block
+		uint32_t timeOffset;
+		uint8_t flags;
+		uint8_t length;
+	};
+
+	static_assert(sizeof(CaptureFileHeader) == 16, "Capture file header layout");
+	static_assert(sizeof(CaptureBlockHeader) == 48, "Capture block header layout");
+
+	// A record read back from a block. frame points into the block
+	struct CaptureRecord
+	{
+		uint64_t time;
+		uint8_t flags;
+		uint8_t length;
+		const uint8_t* frame;
+	};
+
+	// Returns the offset of the first block in a capture file with the given header
+	uint32_t GetCaptureDataOffset(const CaptureFileHeader& header);
+
+	// Returns the address of an addressed telegram (aA1..., aL3..., 0..15), or -1
+	int8_t GetCaptureAddress(const uint8_t* frame, uint8_t length);
+
+	// Whether a block may contain telegrams with the given leading character and address (-1 = any address)
+	bool CaptureBlockMayContain(const CaptureBlockHeader& header, char type, int8_t address);
+
+	// Whether a block header read back is intact: its magic is right and its records don't reach past the block.
+	// Blocks cut by a power loss (e.g. the last one of a FlightRecorder segment) may not be
+	bool IsCaptureBlockIntact(const CaptureBlockHeader& header);
+
+	// Reads the record at offset (relative to the end of the block header) and advances offset to the next one.
+	// Returns false at the end of the block or if the record is damaged. Records are never read past the block, even
+	// if the header isn't intact
+	bool ReadCaptureRecord(const uint8_t* block, const CaptureBlockHeader& header, uint16_t& offset, CaptureRecord& record);
+
+	// Fills one block in a caller-provided buffer of IBIS_CAPTURE_BLOCK_SIZE bytes
+	class CaptureBlock
+	{
+	public:
+		explicit CaptureBlock(uint8_t* buffer);
+
+		// Empties the block
+		void Reset();
+
+		// Appends a record. Returns false if it doesn't fit, either because the block is full or because the time is
+		// too far from the first record in the block (about 71 minutes). Write the block out and Reset() it then
+		bool Append(uint64_t time, uint8_t flags, const uint8_t* frame, uint8_t length);
+
+		bool IsEmpty() const { return _header.recordCount == 0; }
+		const CaptureBlockHeader& GetHeader() const { return _header; }
+
+		// Writes the header into the buffer and returns the complete block, ready to be stored
+		const uint8_t* Finish();
+
+	private:
+		uint8_t* _buffer;
+		CaptureBlockHeader _header;
+	};
+}
@@ -0,0 +1,263 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISCharset.h"
+
+// First and last codepoint covered by the transliteration table (Latin-1 Supplement and Latin Extended-A)
+#define IBIS_TRANSLITERATION_FIRST 0x00A0
+#if IBIS_TRANSLITERATE_EXTENDED
+#define IBIS_TRANSLITERATION_LAST 0x017F
+#else
+#define IBIS_TRANSLITERATION_LAST 0x00FF
+#endif
+
+// Transliteration of U+00A0..U+017F (or U+00FF), indexed by codepoint. German umlauts need to be handled: IBIS telegrams (and any
+// text transmitted inside them) are plain in ASCII format, where umlauts are not part of. To fix this, the VDV 300
+// document uses a slightly altered ASCII table, which replaces a couple of never-used characters from the original
+// ASCII tables with the german umlauts (see VDV 300 page 50). Everything else is mapped to its closest ASCII spelling,
+// but never to one of those slots ([\]{|}~), which would show up as an umlaut
+static const char TransliterationTable[IBIS_TRANSLITERATION_LAST - IBIS_TRANSLITERATION_FIRST + 1][2] PROGMEM =
+{
+	{ ' ', 0 }, { '!', 0 }, { 'c', 0 }, { 'L', 0 }, { '$', 0 }, { 'Y', 0 }, { '!', 0 }, { 'S', 0 }, // U+00A0  ¡¢£¤¥¦§
+	{ '"', 0 }, { 'C', 0 }, { 'a', 0 }, { '"', 0 }, { '?', 0 }, { 0, 0 }, { 'R', 0 }, { '-', 0 }, // U+00A8 ¨©ª«¬ ®¯
+	{ 'o', 0 }, { '+', 0 }, { '2', 0 }, { '3', 0 }, { '\'', 0 }, { 'u', 0 }, { 'P', 0 }, { '.', 0 }, // U+00B0 °±²³´µ¶·
+	{ ',', 0 }, { '1', 0 }, { 'o', 0 }, { '"', 0 }, { '?', 0 }, { '?', 0 }, { '?', 0 }, { '?', 0 }, // U+00B8 ¸¹º»¼½¾¿
+	{ 'A', 0 }, { 'A', 0 }, { 'A', 0 }, { 'A', 0 }, { '[', 0 }, { 'A', 0 }, { 'A', 'E' }, { 'C', 0 }, // U+00C0 ÀÁÂÃÄÅÆÇ
+	{ 'E', 0 }, { 'E', 0 }, { 'E', 0 }, { 'E', 0 }, { 'I', 0 }, { 'I', 0 }, { 'I', 0 }, { 'I', 0 }, // U+00C8 ÈÉÊËÌÍÎÏ
+	{ 'D', 0 }, { 'N', 0 }, { 'O', 0 }, { 'O', 0 }, { 'O', 0 }, { 'O', 0 }, { '\\', 0 }, { 'x', 0 }, // U+00D0 ÐÑÒÓÔÕÖ×
+	{ 'O', 0 }, { 'U', 0 }, { 'U', 0 }, { 'U', 0 }, { ']', 0 }, { 'Y', 0 }, { 'T', 'H' }, { '~', 0 }, // U+00D8 ØÙÚÛÜÝÞß
+	{ 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { 'a', 0 }, { '{', 0 }, { 'a', 0 }, { 'a', 'e' }, { 'c', 0 }, // U+00E0 àáâãäåæç
+	{ 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'e', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, { 'i', 0 }, // U+00E8 èéêëìíîï
+	{ 'd', 0 }, { 'n', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { 'o', 0 }, { '|', 0 }, { ':', 0 }, // U+00F0 ðñòóôõö÷
+	{ 'o', 0 }, { 'u', 0 }, { 'u', 0 }, { 'u', 0 }, { '}', 0 }, { 'y', 0 }, { 't', 'h' }, { 'y', 0 }, // U+00F8 øùúûüýþÿ
+#if IBIS_TRANSLITERATE_EXTENDED
+	{ 'A', 0 }, { 'a', 0 }, { 'A', 0 }, { 'a', 0 }, { 'A', 0 }, { 'a', 0 }, { 'C', 0 }, { 'c', 0 }, // U+0100 ĀāĂăĄąĆć
+	{ 'C', 0 }, { 'c', 0 }, { 'C', 0 }, { 'c', 0 }, { 'C', 0 }, { 'c', 0 }, { 'D', 0 }, { 'd', 0 }, // U+0108 ĈĉĊċČčĎď
+	{ 'D', 0 }, { 'd', 0 }, { 'E', 0 }, { 'e', 0 }, { 'E', 0 }, { 'e', 0 }, { 'E', 0 }, { 'e', 0 }, // U+0110 ĐđĒēĔĕĖė
+	{ 'E', 0 }, { 'e', 0 }, { 'E', 0 }, { 'e', 0 }, { 'G', 0 }, { 'g', 0 }, { 'G', 0 }, { 'g', 0 }, // U+0118 ĘęĚěĜĝĞğ
+	{ 'G', 0 }, { 'g', 0 }, { 'G', 0 }, { 'g', 0 }, { 'H', 0 }, { 'h', 0 }, { 'H', 0 }, { 'h', 0 }, // U+0120 ĠġĢģĤĥĦħ
+	{ 'I', 0 }, { 'i', 0 }, { 'I', 0 }, { 'i', 0 }, { 'I', 0 }, { 'i', 0 }, { 'I', 0 }, { 'i', 0 }, // U+0128 ĨĩĪīĬĭĮį
+	{ 'I', 0 }, { 'i', 0 }, { 'I', 'J' }, { 'i', 'j' }, { 'J', 0 }, { 'j', 0 }, { 'K', 0 }, { 'k', 0 }, // U+0130 İıĲĳĴĵĶķ
+	{ 'k', 0 }, { 'L', 0 }, { 'l', 0 }, { 'L', 0 }, { 'l', 0 }, { 'L', 0 }, { 'l', 0 }, { 'L', 0 }, // U+0138 ĸĹĺĻļĽľĿ
+	{ 'l', 0 }, { 'L', 0 }, { 'l', 0 }, { 'N', 0 }, { 'n', 0 }, { 'N', 0 }, { 'n', 0 }, { 'N', 0 }, // U+0140 ŀŁłŃńŅņŇ
+	{ 'n', 0 }, { 'n', 0 }, { 'N', 0 }, { 'n', 0 }, { 'O', 0 }, { 'o', 0 }, { 'O', 0 }, { 'o', 0 }, // U+0148 ňŉŊŋŌōŎŏ
+	{ 'O', 0 }, { 'o', 0 }, { 'O', 'E' }, { 'o', 'e' }, { 'R', 0 }, { 'r', 0 }, { 'R', 0 }, { 'r', 0 }, // U+0150 ŐőŒœŔŕŖŗ
+	{ 'R', 0 }, { 'r', 0 }, { 'S', 0 }, { 's', 0 }, { 'S', 0 }, { 's', 0 }, { 'S', 0 }, { 's', 0 }, // U+0158 ŘřŚśŜŝŞş
+	{ 'S', 0 }, { 's', 0 }, { 'T', 0 }, { 't', 0 }, { 'T', 0 }, { 't', 0 }, { 'T', 0 }, { 't', 0 }, // U+0160 ŠšŢţŤťŦŧ
+	{ 'U', 0 }, { 'u', 0 }, { 'U', 0 }, { 'u', 0 }, { 'U', 0 }, { 'u', 0 }, { 'U', 0 }, { 'u', 0 }, // U+0168 ŨũŪūŬŭŮů
+	{ 'U', 0 }, { 'u', 0 }, { 'U', 0 }, { 'u', 0 }, { 'W', 0 }, { 'w', 0 }, { 'Y', 0 }, { 'y', 0 }, // U+0170 ŰűŲųŴŵŶŷ
+	{ 'Y', 0 }, { 'Z', 0 }, { 'z', 0 }, { 'Z', 0 }, { 'z', 0 }, { 'Z', 0 }, { 'z', 0 }, { 's', 0 }, // U+0178 ŸŹźŻżŽžſ
+#endif
+};
+
+#if IBIS_TRANSLITERATE_PUNCTUATION
+// Typographic punctuation that commonly ends up in texts, sorted by codepoint
+static const ArduinoIBIS::CharacterOverride PunctuationTable[] PROGMEM =
+{
+	{ 0x2010, { '-', 0 } }, // Hyphen
+	{ 0x2011, { '-', 0 } }, // Non-breaking hyphen
+	{ 0x2013, { '-', 0 } }, // En dash
+	{ 0x2014, { '-', 0 } }, // Em dash
+	{ 0x2018, { '\'', 0 } }, // Left single quotation mark
+	{ 0x2019, { '\'', 0 } }, // Right single quotation mark
+	{ 0x201A, { ',', 0 } }, // Single low-9 quotation mark
+	{ 0x201C, { '"', 0 } }, // Left double quotation mark
+	{ 0x201D, { '"', 0 } }, // Right double quotation mark
+	{ 0x201E, { '"', 0 } }, // Double low-9 quotation mark
+	{ 0x2022, { '.', 0 } }, // Bullet
+	{ 0x2026, { '.', '.' } }, // Ellipsis
+	{ 0x2039, { '<', 0 } }, // Single left-pointing angle quotation mark
+	{ 0x203A, { '>', 0 } }, // Single right-pointing angle quotation mark
+	{ 0x20AC, { 'E', 0 } }, // Euro sign
+};
+#endif
+
+// Identity for everything but the VDV 300 umlaut slots
+const uint8_t ArduinoIBIS::Charsets::PlainASCII[128] PROGMEM =
+{
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+	' ', '!', '"', '#', '$', '%', '&', '\'', '(', ')', '*', '+', ',', '-', '.', '/',
+	'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', ';', '<', '=', '>', '?',
+	'@', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
+	'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', 'A', 'O', 'U', '^', '_', // [\] are Ä Ö Ü
+	'`', 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o',
+	'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z', 'a', 'o', 'u', 's', 0x7F, // {|}~ are ä ö ü ß
+};
+
+// Binary search for a codepoint in a sorted override table. Returns nullptr if it's not in there
+static const ArduinoIBIS::CharacterOverride* FindOverride(const ArduinoIBIS::CharacterOverride* table, uint8_t count, uint16_t codepoint, bool progmem)
+{
+	uint8_t low = 0;
+	uint8_t high = count;
+	while (low < high)
+	{
+		uint8_t middle = (low + high) / 2;
+		uint16_t candidate = progmem ? pgm_read_word(&table[middle].codepoint) : table[middle].codepoint;
+		if (candidate == codepoint)
+		{
+			return &table[middle];
+		}
+		else if (candidate < codepoint)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return nullptr;
+}
+
+// Decodes a three or four byte UTF-8 sequence, whose lead byte has already been consumed. Returns 0 for broken
+// sequences. Kept out of line, so the common path in TranscodeText() stays small
+static uint32_t __attribute__((noinline)) DecodeLongSequence(uint8_t lead, const uint8_t*& in)
+{
+	uint8_t continuationBytes = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : 0;
+	uint32_t codepoint = lead & (0x3F >> continuationBytes);
+	for (uint8_t i = 0; i < continuationBytes; i++)
+	{
+		if ((in[i] & 0xC0) != 0x80)
+		{
+			return 0;
+		}
+		codepoint = (codepoint << 6) | (in[i] & 0x3F);
+	}
+
+	in += continuationBytes;
+	return continuationBytes > 0 ? codepoint : 0;
+}
+
+// Looks up the replacement of a codepoint in the per-device overrides and the punctuation table. Returns '?' if there
+// is none. Kept out of line for the same reason as DecodeLongSequence()
+static void __attribute__((noinline)) LookupSlow(uint32_t codepoint, const ArduinoIBIS::TextEncoding* encoding, char& first, char& second)
+{
+	const ArduinoIBIS::CharacterOverride* entry = nullptr;
+	if (encoding != nullptr && (entry = FindOverride(encoding->overrides, encoding->overrideCount, codepoint, false)) != nullptr)
+	{
+		first = entry->replacement[0];
+		second = entry->replacement[1];
+	}
+	else if (codepoint - IBIS_TRANSLITERATION_FIRST <= IBIS_TRANSLITERATION_LAST - IBIS_TRANSLITERATION_FIRST)
+	{
+		first = pgm_read_byte(&TransliterationTable[codepoint - IBIS_TRANSLITERATION_FIRST][0]);
+		second = pgm_read_byte(&TransliterationTable[codepoint - IBIS_TRANSLITERATION_FIRST][1]);
+	}
+#if IBIS_TRANSLITERATE_PUNCTUATION
+	else if ((entry = FindOverride(PunctuationTable, sizeof(PunctuationTable) / sizeof(PunctuationTable[0]), codepoint, true)) != nullptr)
+	{
+		first = pgm_read_byte(&entry->replacement[0]);
+		second = pgm_read_byte(&entry->replacement[1]);
+	}
+#endif
+	else
+	{
+		first = '?';
+		second = '\0';
+	}
+}
+
+// The transcoding loop, instantiated with and without charset, so devices speaking plain VDV 300 don't pay for the
+// extra lookup per byte. Without IBIS_TRANSCODE_SPECIALIZED, only the instance with charset is used, which then checks
+// whether there is one
+template <bool HasCharset>
+static IBIS_HOT uint16_t Transcode(const char* text, char* out, uint16_t outSize, const ArduinoIBIS::TextEncoding* encoding)
+{
+	const uint8_t* charset = HasCharset && encoding != nullptr ? encoding->charset : nullptr;
+	auto map = [charset](uint8_t value) -> char
+	{
+		if (!HasCharset || (!IBIS_TRANSCODE_SPECIALIZED && charset == nullptr))
+		{
+			return (char)value;
+		}
+
+		return (char)pgm_read_byte(&charset[value & 0x7F]);
+	};
+
+	bool hasOverrides = encoding != nullptr && encoding->overrideCount > 0;
+	const uint8_t* in = (const uint8_t*)text;
+	uint16_t length = 0;
+	while (*in != '\0' && length < outSize)
+	{
+		// Plain ASCII is copied as-is (only going through the charset, if any)
+		uint8_t value = *in++;
+		if (value < 0x80)
+		{
+			out[length++] = map(value);
+			continue;
+		}
+
+		// Decode the UTF-8 sequence. Two byte sequences (everything up to U+07FF) are by far the most common, so they
+		// get the short path. Broken sequences are replaced by a single '?'
+		uint32_t codepoint;
+		if ((uint8_t)(value - 0xC2) < 0x1E && (*in & 0xC0) == 0x80)
+		{
+			codepoint = ((value & 0x1F) << 6) | (*in++ & 0x3F);
+		}
+		else if ((codepoint = DecodeLongSequence(value, in)) == 0)
+		{
+			out[length++] = map('?');
+			continue;
+		}
+
+		// Latin-1 and Latin Extended-A straight from the table, everything else (and overrides) takes the slow path
+		char first;
+		char second;
+		if (!hasOverrides && codepoint - IBIS_TRANSLITERATION_FIRST <= IBIS_TRANSLITERATION_LAST - IBIS_TRANSLITERATION_FIRST)
+		{
+			first = pgm_read_byte(&TransliterationTable[codepoint - IBIS_TRANSLITERATION_FIRST][0]);
+			second = pgm_read_byte(&TransliterationTable[codepoint - IBIS_TRANSLITERATION_FIRST][1]);
+		}
+		else
+		{
+			LookupSlow(codepoint, encoding, first, second);
+		}
+
+		if (first != '\0')
+		{
+			out[length++] = map(first);
+		}
+		if (second != '\0' && length < outSize)
+		{
+			out[length++] = map(second);
+		}
+	}
+
+	return length;
+}
+
+uint16_t ArduinoIBIS::TranscodeText(const char* text, char* out, uint16_t outSize, const TextEncoding* encoding)
+{
+#if IBIS_TRANSCODE_SPECIALIZED
+	if (encoding != nullptr && encoding->charset != nullptr)
+	{
+		return Transcode<true>(text, out, outSize, encoding);
+	}
+
+	return Transcode<false>(text, out, outSize, encoding);
+#else
+	return Transcode<true>(text, out, outSize, encoding);
+#endif
+}
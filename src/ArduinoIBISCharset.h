@@ -0,0 +1,64 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <Arduino.h>
+#include "ArduinoIBISProfile.h"
+
+namespace ArduinoIBIS
+{
+	// Replaces a single Unicode character with up to two characters of the VDV 300 character set. A replacement of
+	// two null characters drops the character
+	struct CharacterOverride
+	{
+		uint16_t codepoint;
+		char replacement[2];
+	};
+
+	// Describes how text is transcoded for a device. The overrides take precedence over the built-in transliteration
+	// and must be sorted by codepoint, as they're looked up with a binary search.
+	// The charset maps every VDV 300 character (0..127) to the byte the device expects, for devices which use other
+	// code pages for the umlaut slots. It must point to 128 bytes in PROGMEM, nullptr means the device speaks VDV 300
+	struct TextEncoding
+	{
+		const CharacterOverride* overrides = nullptr;
+		uint8_t overrideCount = 0;
+		const uint8_t* charset = nullptr;
+	};
+
+	// Built-in charsets
+	namespace Charsets
+	{
+		// For devices without umlauts: the VDV 300 umlaut slots are shown as the plain vowels (ä -> a, ß -> s)
+		extern const uint8_t PlainASCII[128];
+	}
+
+	// Transcodes UTF-8 text to the VDV 300 character set in a single pass, writing at most outSize bytes (no null
+	// terminator) and returning the number of bytes written. German umlauts go to the VDV 300 slots, everything else in
+	// Latin-1 and Latin Extended-A is transliterated (é -> e, ł -> l, Œ -> OE), unknown characters become '?'. The
+	// size profile leaves out Latin Extended-A and punctuation (see ArduinoIBISProfile.h).
+	// If the encoding has a charset, it's applied in the same pass.
+	// The output can be stored to send it later without transcoding again. Pass it to the Port::Build encoders without
+	// an encoding then, so the charset isn't applied twice
+	uint16_t TranscodeText(const char* text, char* out, uint16_t outSize, const TextEncoding* encoding = nullptr);
+}
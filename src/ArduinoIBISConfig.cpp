@@ -0,0 +1,165 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISConfig.h"
+
+// Encodings for the built-in charsets
+static const ArduinoIBIS::TextEncoding PlainASCIIEncoding = { nullptr, 0, ArduinoIBIS::Charsets::PlainASCII };
+
+// The config may be in flash, where ESP8266 can only read aligned words, so records are copied out with memcpy_P
+template <typename T>
+static T ReadRecord(const uint8_t* data, uint16_t offset)
+{
+	T record;
+	memcpy_P(&record, data + offset, sizeof(T));
+	return record;
+}
+
+bool ArduinoIBIS::Config::Load(const uint8_t* data, size_t size)
+{
+	_data = nullptr;
+	_header = {};
+	if (data == nullptr || size < sizeof(ConfigHeader))
+	{
+		return false;
+	}
+
+	ConfigHeader header = ReadRecord<ConfigHeader>(data, 0);
+	if (header.magic != IBIS_CONFIG_MAGIC || header.version == 0 || header.version > IBIS_CONFIG_VERSION || header.size > size)
+	{
+		return false;
+	}
+
+	// Both tables have to be inside the config
+	uint32_t devicesEnd = header.devicesOffset + (uint32_t)header.deviceCount * sizeof(ConfigDevice);
+	uint32_t timersEnd = header.timersOffset + (uint32_t)header.timerCount * sizeof(ConfigTimer);
+	if (header.devicesOffset < sizeof(ConfigHeader) || devicesEnd > header.size ||
+		header.timersOffset < sizeof(ConfigHeader) || timersEnd > header.size)
+	{
+		return false;
+	}
+
+	// The config may not come from ibis_config.py, so everything it rejects is rejected here as well
+	bool seen[IBIS_MAX_DEVICES] = {};
+	for (uint8_t i = 0; i < header.deviceCount; i++)
+	{
+		ConfigDevice device = ReadRecord<ConfigDevice>(data, header.devicesOffset + i * sizeof(ConfigDevice));
+		if (device.address >= IBIS_MAX_DEVICES || seen[device.address] || device.charset > ConfigCharsetPlainASCII ||
+			device.font > ConfigFontFixed5x7)
+		{
+			return false;
+		}
+		seen[device.address] = true;
+	}
+
+	for (uint8_t i = 0; i < header.timerCount; i++)
+	{
+		uint16_t offset = header.timersOffset + i * sizeof(ConfigTimer);
+		ConfigTimer timer = ReadRecord<ConfigTimer>(data, offset);
+		if (timer.intervalMs == 0 || timer.producer >= IBIS_MAX_PRODUCERS || timer.payloadLength == 0 ||
+			timer.payloadLength > IBIS_TELEGRAM_MAX_LENGTH - 2 || (uint32_t)offset + timer.payloadOffset + timer.payloadLength > header.size)
+		{
+			return false;
+		}
+
+		// Payloads are ASCII, control characters only as the separators of DS021a and GSP. A CR would end the frame early
+		for (uint8_t j = 0; j < timer.payloadLength; j++)
+		{
+			uint8_t value = pgm_read_byte(data + offset + timer.payloadOffset + j);
+			if ((value < 0x20 && value != 0x03 && value != 0x04 && value != 0x05 && value != 0x0A) || value > 0x7F)
+			{
+				return false;
+			}
+		}
+	}
+
+	_data = data;
+	_header = header;
+	return true;
+}
+
+bool ArduinoIBIS::Config::Apply(Port& port)
+{
+	Remove(port);
+	if (_data == nullptr)
+	{
+		return false;
+	}
+
+	for (uint8_t i = 0; i < _header.deviceCount; i++)
+	{
+		ConfigDevice device = ReadRecord<ConfigDevice>(_data, _header.devicesOffset + i * sizeof(ConfigDevice));
+		DeviceProfile& profile = _profiles[device.address];
+		profile.encoding = device.charset == ConfigCharsetPlainASCII ? &PlainASCIIEncoding : nullptr;
+		profile.font = device.font == ConfigFontFixed5x7 ? &Fonts::Fixed5x7 : nullptr;
+		profile.width = device.width;
+		port.SetDeviceProfile(device.address, &profile);
+		_applied[device.address] = true;
+	}
+
+	for (uint8_t i = 0; i < _header.timerCount; i++)
+	{
+		const uint8_t* record = _data + _header.timersOffset + i * sizeof(ConfigTimer);
+		ConfigTimer timer = ReadRecord<ConfigTimer>(record, 0);
+		int8_t handle = port.AddTimer(timer.intervalMs, SendTimer, (void*)record);
+		if (handle < 0)
+		{
+			return false;
+		}
+		_timers[_timerCount++] = handle;
+	}
+	return true;
+}
+
+void ArduinoIBIS::Config::Remove(Port& port)
+{
+	for (uint8_t i = 0; i < _timerCount; i++)
+	{
+		port.RemoveTimer(_timers[i]);
+	}
+	_timerCount = 0;
+
+	// The previous config may have had devices the current one doesn't
+	for (uint8_t address = 0; address < IBIS_MAX_DEVICES; address++)
+	{
+		if (_applied[address])
+		{
+			port.SetDeviceProfile(address, nullptr);
+			_applied[address] = false;
+		}
+	}
+}
+
+void ArduinoIBIS::Config::SendTimer(Port& port, void* context)
+{
+	const uint8_t* record = (const uint8_t*)context;
+	ConfigTimer timer = ReadRecord<ConfigTimer>(record, 0);
+
+	char payload[IBIS_TELEGRAM_MAX_LENGTH];
+	memcpy_P(payload, record + timer.payloadOffset, timer.payloadLength);
+
+	Telegram telegram;
+	telegram.Append(payload, timer.payloadLength);
+	telegram.Finish();
+	port.Send(telegram, timer.producer);
+}
@@ -0,0 +1,130 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "ArduinoIBIS.h"
+
+// Compiled configuration of the devices on the bus and the telegrams sent periodically, made by tools/ibis_config.py
+// from JSON or YAML. All numbers are little endian, all tables are 4 byte aligned.
+//
+// A config is a ConfigHeader, a table of ConfigDevice and a table of ConfigTimer, followed by the telegram payloads
+// of the timers. Instead of being parsed, it's used where it is: Load() only checks the header and the bounds of the
+// tables, and the payloads are read from the config whenever a timer is due. It can be a const array in flash (as
+// generated with --header, in PROGMEM on ESP8266) or a buffer holding a config file.
+//
+// Fonts and charsets are given by the ids of the built-in ones (ConfigCharset, ConfigFont). Versions only grow; a
+// config with a newer version than IBIS_CONFIG_VERSION is rejected, so old firmware doesn't misread it
+#define IBIS_CONFIG_MAGIC 0x46434249 // "IBCF"
+#define IBIS_CONFIG_VERSION 1
+
+namespace ArduinoIBIS
+{
+	enum ConfigCharset : uint8_t
+	{
+		ConfigCharsetDefault = 0, // The port's encoding
+		ConfigCharsetPlainASCII = 1
+	};
+
+	enum ConfigFont : uint8_t
+	{
+		ConfigFontNone = 0,
+		ConfigFontFixed5x7 = 1
+	};
+
+	struct ConfigHeader
+	{
+		uint32_t magic;
+		uint16_t version;
+
+		// Size of the whole config
+		uint16_t size;
+
+		uint8_t deviceCount;
+		uint8_t timerCount;
+
+		// Offsets of the tables from the start of the config
+		uint16_t devicesOffset;
+		uint16_t timersOffset;
+		uint16_t reserved;
+	};
+
+	// A DeviceProfile
+	struct ConfigDevice
+	{
+		uint8_t address;
+		uint8_t charset;
+		uint8_t font;
+		uint8_t reserved;
+		uint16_t width;
+		uint16_t reserved2;
+	};
+
+	// A telegram sent every intervalMs
+	struct ConfigTimer
+	{
+		uint32_t intervalMs;
+
+		// Offset of the payload (without CR and checksum) from the start of this record
+		uint16_t payloadOffset;
+		uint8_t payloadLength;
+
+		// Producer the telegram is sent by (see Port::SetProducer)
+		uint8_t producer;
+	};
+
+	static_assert(sizeof(ConfigHeader) == 16, "Config header layout");
+	static_assert(sizeof(ConfigDevice) == 8, "Config device layout");
+	static_assert(sizeof(ConfigTimer) == 8, "Config timer layout");
+
+	class Config
+	{
+	public:
+		// Checks a compiled config. It's not copied, so it has to stay valid while the config is in use. Returns false
+		// if it's damaged, has a newer version, has anything ibis_config.py rejects (e.g. duplicate device addresses or
+		// a CR in a payload) or doesn't fit this build (e.g. addresses beyond IBIS_MAX_DEVICES)
+		bool Load(const uint8_t* data, size_t size);
+
+		// Sets the device profiles on the port and starts the timers. Profiles and timers of an earlier Apply() are
+		// removed first. Returns false if not all timers could be added (see IBIS_MAX_TIMERS)
+		bool Apply(Port& port);
+
+		// Removes the timers started by Apply() and the device profiles it set
+		void Remove(Port& port);
+
+		uint8_t GetDeviceCount() const { return _header.deviceCount; }
+		uint8_t GetTimerCount() const { return _header.timerCount; }
+
+	private:
+		// Timer callback, the context is the ConfigTimer in the config
+		static void SendTimer(Port& port, void* context);
+
+		const uint8_t* _data = nullptr;
+		ConfigHeader _header = {};
+
+		// The port keeps pointers to the profiles
+		DeviceProfile _profiles[IBIS_MAX_DEVICES];
+		bool _applied[IBIS_MAX_DEVICES] = {};
+		int8_t _timers[IBIS_MAX_TIMERS];
+		uint8_t _timerCount = 0;
+	};
+}
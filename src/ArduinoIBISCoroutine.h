@@ -0,0 +1,218 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "ArduinoIBIS.h"
+
+// Coroutines need C++20 (e.g. ESP32 with -std=gnu++20). On older toolchains this header is empty
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+
+// Coroutine frames are taken from a static pool instead of the heap. A sequence whose frame doesn't fit, or which is
+// started while all frames are in use, doesn't run at all (see Sequence::IsStarted). A telegram built in a sequence
+// (e.g. for SendAndWait) is kept in its frame while it's awaited, which takes IBIS_TELEGRAM_MAX_LENGTH bytes
+#ifndef IBIS_COROUTINE_FRAME_SIZE
+#define IBIS_COROUTINE_FRAME_SIZE 320
+#endif
+#ifndef IBIS_COROUTINE_FRAMES
+#define IBIS_COROUTINE_FRAMES 4
+#endif
+
+namespace ArduinoIBIS
+{
+	// Return type for telegram sequences written as coroutines. A sequence starts running as soon as it's called and
+	// is resumed by Port::Run() whenever something it awaits is done, so it never blocks the loop:
+	//
+	//   ArduinoIBIS::Sequence ShowDestination(ArduinoIBIS::Port& port)
+	//   {
+	//       co_await ArduinoIBIS::SendAndWait(port, ArduinoIBIS::Port::Build::DS003a("Hauptbahnhof"));
+	//       co_await ArduinoIBIS::Delay(port, 2000);
+	//       port.DS003c("Next page");
+	//       ArduinoIBIS::Response status = co_await ArduinoIBIS::WaitForResponse(port, 500);
+	//   }
+	class Sequence
+	{
+	public:
+		struct promise_type
+		{
+			Sequence get_return_object() { return Sequence(true); }
+			static Sequence get_return_object_on_allocation_failure() { return Sequence(false); }
+			std::suspend_never initial_suspend() noexcept { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() {}
+
+			static void* operator new(size_t size) noexcept
+			{
+				if (size > IBIS_COROUTINE_FRAME_SIZE)
+				{
+					return nullptr;
+				}
+
+				for (uint8_t i = 0; i < IBIS_COROUTINE_FRAMES; i++)
+				{
+					if (!_frameUsed[i])
+					{
+						_frameUsed[i] = true;
+						return _frames[i];
+					}
+				}
+				return nullptr;
+			}
+
+			static void operator delete(void* frame)
+			{
+				for (uint8_t i = 0; i < IBIS_COROUTINE_FRAMES; i++)
+				{
+					if (frame == _frames[i])
+					{
+						_frameUsed[i] = false;
+					}
+				}
+			}
+
+		private:
+			alignas(max_align_t) static inline uint8_t _frames[IBIS_COROUTINE_FRAMES][IBIS_COROUTINE_FRAME_SIZE];
+			static inline bool _frameUsed[IBIS_COROUTINE_FRAMES] = {};
+		};
+
+		// Whether the sequence got a frame and was started
+		bool IsStarted() const { return _started; }
+
+	private:
+		explicit Sequence(bool started) : _started(started) {}
+
+		bool _started;
+	};
+
+	// Result of WaitForResponse(). telegram is nullptr if nothing was received in time. It points into the port's
+	// receive buffer, so it has to be copied if it is needed after the next co_await
+	struct Response
+	{
+		const char* telegram = nullptr;
+		uint8_t length = 0;
+	};
+
+	// Suspends the sequence for the given amount of milliseconds, using a one-shot port timer. Returns false without
+	// waiting if all timers are in use, rather than hanging forever
+	inline auto Delay(Port& port, uint32_t ms)
+	{
+		struct Awaitable
+		{
+			Port& port;
+			uint32_t ms;
+			bool delayed;
+
+			bool await_ready() const { return false; }
+			bool await_suspend(std::coroutine_handle<> handle)
+			{
+				delayed = port.AddTimer(ms, [](Port&, void* context)
+				{
+					std::coroutine_handle<>::from_address(context).resume();
+				}, handle.address(), false) >= 0;
+				return delayed;
+			}
+			bool await_resume() const { return delayed; }
+		};
+
+		return Awaitable{ port, ms, false };
+	}
+
+	// Sends a telegram (see Port::Send) and suspends the sequence until it's on the wire, which with the transmit queue
+	// may take a while. Returns false if it was dropped instead
+	inline auto SendAndWait(Port& port, const Telegram& telegram, uint8_t producer)
+	{
+		struct Awaitable
+		{
+			Port& port;
+			const Telegram& telegram;
+			uint8_t producer;
+			std::coroutine_handle<> handle;
+			bool suspended;
+			bool done;
+			bool sent;
+
+			bool await_ready() const { return false; }
+			bool await_suspend(std::coroutine_handle<> h)
+			{
+				// Without the queue, the callback is called before Send() returns, then there's nothing to wait for
+				handle = h;
+				if (!port.Send(telegram, producer, [](Port&, bool sent, void* context)
+				{
+					Awaitable* self = static_cast<Awaitable*>(context);
+					self->sent = sent;
+					self->done = true;
+					if (self->suspended)
+					{
+						self->handle.resume();
+					}
+				}, this))
+				{
+					return false;
+				}
+
+				suspended = !done;
+				return suspended;
+			}
+			bool await_resume() const { return sent; }
+		};
+
+		return Awaitable{ port, telegram, producer, {}, false, false, false };
+	}
+
+	// Same for the producer selected on the port
+	inline auto SendAndWait(Port& port, const Telegram& telegram)
+	{
+		return SendAndWait(port, telegram, port.GetSelectedProducer());
+	}
+
+	// Suspends the sequence until the next telegram is received or timeoutMs have passed (see Port::ExpectResponse)
+	inline auto WaitForResponse(Port& port, uint32_t timeoutMs)
+	{
+		struct Awaitable
+		{
+			Port& port;
+			uint32_t timeoutMs;
+			std::coroutine_handle<> handle;
+			Response response;
+
+			bool await_ready() const { return false; }
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				handle = h;
+				port.ExpectResponse(timeoutMs, [](Port&, const char* telegram, uint8_t length, void* context)
+				{
+					Awaitable* self = static_cast<Awaitable*>(context);
+					self->response.telegram = telegram;
+					self->response.length = length;
+					self->handle.resume();
+				}, this);
+			}
+			Response await_resume() const { return response; }
+		};
+
+		return Awaitable{ port, timeoutMs, {}, {} };
+	}
+}
+
+#endif
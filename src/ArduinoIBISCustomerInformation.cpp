@@ -0,0 +1,732 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISCustomerInformation.h"
+#include <string.h>
+
+namespace
+{
+	// Elements the parser looks at, everything else is Other
+	enum Element : uint8_t
+	{
+		Other,
+		AllData,
+		TimeStamp,
+		Value,
+		TripInformation,
+		StopPoint,
+		StopIndex,
+		StopName,
+		DisplayContent,
+		Destination,
+		DestinationName,
+		LineInformation,
+		LineNumber,
+		LineName,
+		Connection,
+		CurrentStopIndex
+	};
+
+	const char* const ElementNames[] =
+	{
+		"", "AllData", "TimeStamp", "Value", "TripInformation", "StopPoint", "StopIndex", "StopName", "DisplayContent",
+		"Destination", "DestinationName", "LineInformation", "LineNumber", "LineName", "Connection", "CurrentStopIndex"
+	};
+
+	uint8_t FindElement(const char* name)
+	{
+		for (uint8_t i = 1; i < sizeof(ElementNames) / sizeof(ElementNames[0]); i++)
+		{
+			if (strcmp(ElementNames[i], name) == 0)
+			{
+				return i;
+			}
+		}
+		return Other;
+	}
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+	}
+
+	// Whether a space separated list contains the text as a whole entry, so "U1" isn't found in "U12"
+	bool ContainsToken(const char* list, const char* text)
+	{
+		size_t length = strlen(text);
+		for (const char* found = strstr(list, text); found != nullptr; found = strstr(found + 1, text))
+		{
+			if ((found == list || found[-1] == ' ') && (found[length] == '\0' || found[length] == ' '))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ParseNumber(const char* text, uint32_t max, uint32_t& value)
+	{
+		if (*text == '\0')
+		{
+			return false;
+		}
+
+		value = 0;
+		for (; *text != '\0'; text++)
+		{
+			if (*text < '0' || *text > '9')
+			{
+				return false;
+			}
+			value = value * 10 + (*text - '0');
+			if (value > max)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Takes HHMM from an xs:dateTime (2025-03-14T07:42:10+01:00)
+	bool ParseTime(const char* text, uint16_t& time)
+	{
+		const char* t = strchr(text, 'T');
+		if (t == nullptr || strlen(t) < 6 || t[3] != ':')
+		{
+			return false;
+		}
+
+		for (uint8_t i = 1; i <= 5; i++)
+		{
+			if (i != 3 && (t[i] < '0' || t[i] > '9'))
+			{
+				return false;
+			}
+		}
+
+		time = (t[1] - '0') * 1000 + (t[2] - '0') * 100 + (t[4] - '0') * 10 + (t[5] - '0');
+		return true;
+	}
+
+	// Copies a value into a field, returns whether it was different
+	bool UpdateText(char* field, const char* value)
+	{
+		if (strcmp(field, value) == 0)
+		{
+			return false;
+		}
+		strcpy(field, value);
+		return true;
+	}
+}
+
+ArduinoIBIS::CustomerInformationParser::CustomerInformationParser()
+{
+	Reset();
+}
+
+uint8_t ArduinoIBIS::CustomerInformationParser::Feed(const char* data, size_t length)
+{
+	_changes = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		Parse(data[i]);
+	}
+	return _changes;
+}
+
+void ArduinoIBIS::CustomerInformationParser::Reset()
+{
+	_markup = Markup::Text;
+	_nameLength = 0;
+	_quote = 0;
+	_emptyElement = false;
+	_matchLength = 0;
+	_depth = 0;
+	_textLength = 0;
+	_textTruncated = false;
+	_inDocument = false;
+	_trips = 0;
+	_currentStopIndex = -1;
+	_hasTime = false;
+	_stopCount = 0;
+	_stop = nullptr;
+}
+
+void ArduinoIBIS::CustomerInformationParser::Parse(char c)
+{
+	switch (_markup)
+	{
+	case Markup::Text:
+		if (c == '<')
+		{
+			_markup = Markup::TagStart;
+		}
+		else if (c == '&')
+		{
+			_matchLength = 0;
+			_markup = Markup::Entity;
+		}
+		else
+		{
+			AppendText(c);
+		}
+		break;
+
+	case Markup::TagStart:
+		_nameLength = 0;
+		if (c == '/')
+		{
+			_markup = Markup::EndTagName;
+		}
+		else if (c == '!')
+		{
+			_matchLength = 0;
+			_markup = Markup::Bang;
+		}
+		else if (c == '?')
+		{
+			_markup = Markup::Skip;
+		}
+		else
+		{
+			_markup = Markup::TagName;
+			Parse(c);
+		}
+		break;
+
+	case Markup::TagName:
+	case Markup::EndTagName:
+		if (c == ':')
+		{
+			// Namespace prefix
+			_nameLength = 0;
+		}
+		else if (!IsSpace(c) && c != '/' && c != '>')
+		{
+			if (_nameLength < sizeof(_name) - 1)
+			{
+				_name[_nameLength++] = c;
+			}
+		}
+		else if (_markup == Markup::EndTagName)
+		{
+			if (c == '>')
+			{
+				_name[_nameLength] = '\0';
+				CloseElement();
+				_markup = Markup::Text;
+			}
+		}
+		else
+		{
+			_name[_nameLength] = '\0';
+			OpenElement();
+			_quote = 0;
+			_emptyElement = false;
+			_markup = Markup::Attributes;
+			Parse(c);
+		}
+		break;
+
+	case Markup::Attributes:
+		if (_quote != 0)
+		{
+			if (c == _quote)
+			{
+				_quote = 0;
+			}
+		}
+		else if (c == '"' || c == '\'')
+		{
+			_quote = c;
+		}
+		else if (c == '>')
+		{
+			if (_emptyElement)
+			{
+				CloseElement();
+			}
+			_markup = Markup::Text;
+		}
+		else
+		{
+			_emptyElement = c == '/';
+		}
+		break;
+
+	case Markup::Bang:
+		// <!-- comment -->, <![CDATA[ text ]]> or a declaration like <!DOCTYPE ...>
+		_match[_matchLength++] = c;
+		if (_matchLength == 2 && memcmp(_match, "--", 2) == 0)
+		{
+			_matchLength = 0;
+			_markup = Markup::Comment;
+		}
+		else if (_matchLength == 7 && memcmp(_match, "[CDATA[", 7) == 0)
+		{
+			_matchLength = 0;
+			_markup = Markup::CData;
+		}
+		else if (memcmp(_match, "--", _matchLength < 2 ? _matchLength : 2) != 0 && memcmp(_match, "[CDATA[", _matchLength) != 0)
+		{
+			_markup = c == '>' ? Markup::Text : Markup::Skip;
+		}
+		break;
+
+	case Markup::Comment:
+		// _matchLength counts the dashes in a row
+		if (c == '>' && _matchLength >= 2)
+		{
+			_markup = Markup::Text;
+		}
+		_matchLength = c == '-' ? _matchLength + 1 : 0;
+		break;
+
+	case Markup::CData:
+		// _matchLength counts the brackets in a row, which are text unless they're followed by '>'
+		if (c == ']')
+		{
+			if (_matchLength < 2)
+			{
+				_matchLength++;
+			}
+			else
+			{
+				AppendText(']');
+			}
+		}
+		else if (c == '>' && _matchLength == 2)
+		{
+			_markup = Markup::Text;
+		}
+		else
+		{
+			for (; _matchLength > 0; _matchLength--)
+			{
+				AppendText(']');
+			}
+			AppendText(c);
+		}
+		break;
+
+	case Markup::Skip:
+		if (c == '>')
+		{
+			_markup = Markup::Text;
+		}
+		break;
+
+	case Markup::Entity:
+		if (c == ';')
+		{
+			_match[_matchLength] = '\0';
+			AppendEntity();
+			_markup = Markup::Text;
+		}
+		else if (_matchLength < sizeof(_match) - 1)
+		{
+			_match[_matchLength++] = c;
+		}
+		else
+		{
+			// Not an entity, the ampersand was meant literally
+			_stats.errors++;
+			AppendText('&');
+			for (uint8_t i = 0; i < _matchLength; i++)
+			{
+				AppendText(_match[i]);
+			}
+			_markup = Markup::Text;
+			Parse(c);
+		}
+		break;
+	}
+}
+
+void ArduinoIBIS::CustomerInformationParser::OpenElement()
+{
+	uint8_t element = FindElement(_name);
+	if (_depth < IBIS_CIS_MAX_DEPTH)
+	{
+		_stack[_depth] = element;
+	}
+	else
+	{
+		element = Other;
+	}
+	if (_depth < 0xFF)
+	{
+		_depth++;
+	}
+
+	switch (element)
+	{
+	case AllData:
+		_inDocument = true;
+		_trips = 0;
+		_currentStopIndex = -1;
+		_hasTime = false;
+		memset(&_trip, 0, sizeof(_trip));
+		_stopCount = 0;
+		_stop = nullptr;
+		break;
+
+	case TripInformation:
+		if (_inDocument && _trips < 0xFF)
+		{
+			_trips++;
+		}
+		break;
+
+	case StopPoint:
+		_stop = nullptr;
+		if (_inDocument && _trips == 1)
+		{
+			if (_stopCount < IBIS_CIS_MAX_STOPS)
+			{
+				_stop = &_stops[_stopCount++];
+				memset(_stop, 0, sizeof(*_stop));
+			}
+			else
+			{
+				_stats.truncated++;
+			}
+		}
+		break;
+
+	case Value:
+		_textLength = 0;
+		_textTruncated = false;
+		break;
+	}
+}
+
+void ArduinoIBIS::CustomerInformationParser::CloseElement()
+{
+	if (_depth == 0)
+	{
+		_stats.errors++;
+		return;
+	}
+
+	uint8_t element = _depth <= IBIS_CIS_MAX_DEPTH ? _stack[_depth - 1] : (uint8_t)Other;
+	if (element != FindElement(_name))
+	{
+		_stats.errors++;
+	}
+
+	switch (element)
+	{
+	case Value:
+		HandleValue();
+		break;
+
+	case StopPoint:
+		_stop = nullptr;
+		break;
+
+	case AllData:
+		if (_inDocument)
+		{
+			_changes |= Commit();
+			_inDocument = false;
+		}
+		break;
+	}
+
+	_depth--;
+}
+
+void ArduinoIBIS::CustomerInformationParser::AppendText(char c)
+{
+	// Only the content of Value elements is needed
+	if (_depth == 0 || _depth > IBIS_CIS_MAX_DEPTH || _stack[_depth - 1] != Value)
+	{
+		return;
+	}
+
+	if (_textLength == 0 && IsSpace(c))
+	{
+		return;
+	}
+
+	if (_textLength < IBIS_CIS_TEXT_LENGTH - 1)
+	{
+		_text[_textLength++] = c;
+	}
+	else
+	{
+		_textTruncated = true;
+	}
+}
+
+void ArduinoIBIS::CustomerInformationParser::AppendEntity()
+{
+	uint32_t codepoint = '?';
+	if (strcmp(_match, "amp") == 0) codepoint = '&';
+	else if (strcmp(_match, "lt") == 0) codepoint = '<';
+	else if (strcmp(_match, "gt") == 0) codepoint = '>';
+	else if (strcmp(_match, "quot") == 0) codepoint = '"';
+	else if (strcmp(_match, "apos") == 0) codepoint = '\'';
+	else if (_match[0] == '#')
+	{
+		const char* digits = _match + 1;
+		uint8_t base = 10;
+		if (*digits == 'x' || *digits == 'X')
+		{
+			digits++;
+			base = 16;
+		}
+
+		codepoint = 0;
+		for (; *digits != '\0' && codepoint <= 0x10FFFF; digits++)
+		{
+			char c = *digits | 0x20;
+			uint8_t digit = c >= '0' && c <= '9' ? c - '0' : (base == 16 && c >= 'a' && c <= 'f' ? c - 'a' + 10 : 0xFF);
+			if (digit == 0xFF)
+			{
+				codepoint = '?';
+				break;
+			}
+			codepoint = codepoint * base + digit;
+		}
+		if (codepoint == 0 || codepoint > 0x10FFFF)
+		{
+			codepoint = '?';
+		}
+	}
+
+	// Texts are kept as UTF-8, like the rest of the document
+	if (codepoint < 0x80)
+	{
+		AppendText(codepoint);
+	}
+	else if (codepoint < 0x800)
+	{
+		AppendText(0xC0 | (codepoint >> 6));
+		AppendText(0x80 | (codepoint & 0x3F));
+	}
+	else if (codepoint < 0x10000)
+	{
+		AppendText(0xE0 | (codepoint >> 12));
+		AppendText(0x80 | ((codepoint >> 6) & 0x3F));
+		AppendText(0x80 | (codepoint & 0x3F));
+	}
+	else
+	{
+		AppendText(0xF0 | (codepoint >> 18));
+		AppendText(0x80 | ((codepoint >> 12) & 0x3F));
+		AppendText(0x80 | ((codepoint >> 6) & 0x3F));
+		AppendText(0x80 | (codepoint & 0x3F));
+	}
+}
+
+uint8_t ArduinoIBIS::CustomerInformationParser::GetParent(uint8_t level) const
+{
+	// Level 0 is the innermost element
+	if (level >= _depth || _depth > IBIS_CIS_MAX_DEPTH)
+	{
+		return Other;
+	}
+	return _stack[_depth - 1 - level];
+}
+
+bool ArduinoIBIS::CustomerInformationParser::IsInside(uint8_t element) const
+{
+	uint8_t depth = _depth < IBIS_CIS_MAX_DEPTH ? _depth : IBIS_CIS_MAX_DEPTH;
+	for (uint8_t i = 0; i < depth; i++)
+	{
+		if (_stack[i] == element)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void ArduinoIBIS::CustomerInformationParser::HandleValue()
+{
+	if (!_inDocument)
+	{
+		return;
+	}
+
+	// Trailing whitespace, and a UTF-8 sequence which was cut in half
+	while (_textLength > 0 && IsSpace(_text[_textLength - 1]))
+	{
+		_textLength--;
+	}
+	if (_textTruncated)
+	{
+		_stats.truncated++;
+		uint8_t start = _textLength;
+		while (start > 0 && (_text[start - 1] & 0xC0) == 0x80)
+		{
+			start--;
+		}
+		if (start > 0 && (_text[start - 1] & 0x80) != 0)
+		{
+			uint8_t lead = _text[start - 1];
+			uint8_t needed = lead >= 0xF0 ? 4 : (lead >= 0xE0 ? 3 : 2);
+			if (_textLength - (start - 1) < needed)
+			{
+				_textLength = start - 1;
+			}
+		}
+	}
+	_text[_textLength] = '\0';
+	if (_textLength == 0)
+	{
+		return;
+	}
+
+	uint8_t field = GetParent(1);
+	uint32_t number;
+	if (field == TimeStamp && GetParent(2) == AllData)
+	{
+		_hasTime = ParseTime(_text, _time);
+		return;
+	}
+	if (field == CurrentStopIndex)
+	{
+		if (ParseNumber(_text, 0xFF, number))
+		{
+			_currentStopIndex = number;
+		}
+		return;
+	}
+
+	// The rest belongs to the current trip, either to one of its stops or to the trip itself
+	if (_trips != 1 || !IsInside(TripInformation))
+	{
+		return;
+	}
+	bool inStop = IsInside(StopPoint);
+	Stop* target = inStop ? _stop : &_trip;
+	if (target == nullptr)
+	{
+		return;
+	}
+
+	if (IsInside(Connection))
+	{
+		// Line names of connections, each one once
+		if (field == LineName && inStop && !ContainsToken(target->connections, _text))
+		{
+			size_t length = strlen(target->connections);
+			if (length + (length > 0) + _textLength < IBIS_CIS_TEXT_LENGTH)
+			{
+				if (length > 0)
+				{
+					target->connections[length++] = ' ';
+				}
+				strcpy(target->connections + length, _text);
+			}
+			else
+			{
+				_stats.truncated++;
+			}
+		}
+		return;
+	}
+
+	// Texts come in several languages, the first one is used
+	if (field == StopIndex && inStop && ParseNumber(_text, 0xFF, number))
+	{
+		target->index = number;
+	}
+	else if (field == StopName && inStop && !(target->present & CustomerInformationNextStop))
+	{
+		strcpy(target->name, _text);
+		target->present |= CustomerInformationNextStop;
+	}
+	else if (field == DestinationName && !(target->present & CustomerInformationDestination))
+	{
+		strcpy(target->destination, _text);
+		target->present |= CustomerInformationDestination;
+	}
+	else if (field == LineNumber && !(target->present & CustomerInformationLine) && ParseNumber(_text, 0xFFFF, number))
+	{
+		target->line = number;
+		target->present |= CustomerInformationLine;
+	}
+}
+
+uint8_t ArduinoIBIS::CustomerInformationParser::Commit()
+{
+	const Stop* current = nullptr;
+	for (uint8_t i = 0; i < _stopCount && _currentStopIndex >= 0; i++)
+	{
+		if (_stops[i].index == _currentStopIndex)
+		{
+			current = &_stops[i];
+			break;
+		}
+	}
+
+	// A field counts as changed if it's new or its value differs from the last document which had it
+	uint8_t found = 0;
+	uint8_t changes = 0;
+	if (_hasTime)
+	{
+		found |= CustomerInformationTime;
+		changes |= _state.time != _time ? CustomerInformationTime : 0;
+		_state.time = _time;
+	}
+
+	const Stop* line = current != nullptr && (current->present & CustomerInformationLine) ? current : &_trip;
+	if (line->present & CustomerInformationLine)
+	{
+		found |= CustomerInformationLine;
+		changes |= _state.line != line->line ? CustomerInformationLine : 0;
+		_state.line = line->line;
+	}
+
+	const Stop* destination = current != nullptr && (current->present & CustomerInformationDestination) ? current : &_trip;
+	if (destination->present & CustomerInformationDestination)
+	{
+		found |= CustomerInformationDestination;
+		changes |= UpdateText(_state.destination, destination->destination) ? CustomerInformationDestination : 0;
+	}
+
+	if (current != nullptr && (current->present & CustomerInformationNextStop))
+	{
+		found |= CustomerInformationNextStop | CustomerInformationProgress;
+		bool name = UpdateText(_state.stopName, current->name);
+		bool connections = UpdateText(_state.connections, current->connections);
+		changes |= name ? CustomerInformationNextStop : 0;
+		changes |= name || connections || _state.stopIndex != current->index ? CustomerInformationProgress : 0;
+		_state.stopIndex = current->index;
+	}
+
+	changes |= found & ~_state.present;
+	_state.present |= found;
+
+	_stats.documents++;
+	if (changes == 0)
+	{
+		_stats.unchanged++;
+	}
+	return changes;
+}
@@ -0,0 +1,182 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+// Parser for VDV 301 (IBIS-IP) CustomerInformationService documents, shared by the target and the host tools (see
+// tools/ibis_vdv301.cpp). It only depends on the C library, so the same code runs on an ESP32 and on a PC.
+//
+// Longest text kept per field (in UTF-8 bytes, longer texts are cut), number of stops kept from the stop sequence of a
+// document and deepest element nesting which is followed
+#ifndef IBIS_CIS_TEXT_LENGTH
+#define IBIS_CIS_TEXT_LENGTH 48
+#endif
+#ifndef IBIS_CIS_MAX_STOPS
+#define IBIS_CIS_MAX_STOPS 24
+#endif
+#ifndef IBIS_CIS_MAX_DEPTH
+#define IBIS_CIS_MAX_DEPTH 16
+#endif
+
+namespace ArduinoIBIS
+{
+	// Fields of the customer information which map to telegrams. Used as bits for the fields a document contained and
+	// for the ones which changed
+	enum CustomerInformationFields : uint8_t
+	{
+		CustomerInformationLine = 0x01, // DS001
+		CustomerInformationDestination = 0x02, // DS003a
+		CustomerInformationNextStop = 0x04, // DS003c
+		CustomerInformationProgress = 0x08, // DS021a (stop index, stop name and connections)
+		CustomerInformationTime = 0x10, // DS005
+		CustomerInformationAll = 0x1F
+	};
+
+	// What the passengers should see, taken from the trip's stop at CurrentStopIndex
+	struct CustomerInformation
+	{
+		// Fields which were in any document so far
+		uint8_t present = 0;
+
+		uint16_t line = 0;
+		uint16_t time = 0; // HHMM, as given in the document's TimeStamp
+		uint8_t stopIndex = 0;
+		char destination[IBIS_CIS_TEXT_LENGTH] = {};
+		char stopName[IBIS_CIS_TEXT_LENGTH] = {};
+		char connections[IBIS_CIS_TEXT_LENGTH] = {}; // Line names of the connections, separated by spaces
+	};
+
+	struct CustomerInformationStatistics
+	{
+		uint32_t documents = 0;
+		uint32_t unchanged = 0; // Documents which didn't change any field
+		uint32_t errors = 0; // Malformed markup, e.g. mismatched tags
+		uint32_t truncated = 0; // Texts which were cut and stops which didn't fit
+	};
+
+	// Streaming parser for CustomerInformationService.GetAllData responses (and the AllData documents sent to
+	// subscribers). Documents can be fed in pieces of any size, e.g. as they arrive from a TCP connection, and several
+	// documents can be fed back to back. Only the elements needed for the telegrams are kept, everything else is
+	// skipped while parsing, so memory use is fixed and doesn't depend on the document size.
+	//
+	// When an AllData element is complete, its fields are compared with the state of the documents before, and Feed()
+	// reports which of them changed. Fields missing from a document keep their last value, so a producer which leaves
+	// out unchanged parts doesn't cause the signs to be cleared.
+	//
+	// Only the first TripInformation (the current trip) is used. The fields are looked up at these paths (namespace
+	// prefixes are ignored):
+	//
+	//   TimeStamp/Value                                              -> time
+	//   CurrentStopIndex/Value                                       -> stopIndex
+	//   StopPoint/StopIndex/Value                                    -> finds the current stop
+	//   StopPoint/StopName/Value                                     -> stopName
+	//   StopPoint/DisplayContent/Destination/DestinationName/Value   -> destination
+	//   StopPoint/DisplayContent/LineInformation/LineNumber/Value    -> line
+	//   StopPoint/Connection/.../LineInformation/LineName/Value      -> connections
+	//
+	// DisplayContent directly below TripInformation is used for stops without their own
+	class CustomerInformationParser
+	{
+	public:
+		CustomerInformationParser();
+
+		// Parses the next piece of input. Returns the fields (CustomerInformationFields) which changed in the documents
+		// that were completed by it, 0 if none were completed or nothing changed
+		uint8_t Feed(const char* data, size_t length);
+
+		// Drops a partially fed document, e.g. after the connection it came from broke. The state is kept
+		void Reset();
+
+		const CustomerInformation& GetState() const { return _state; }
+		const CustomerInformationStatistics& GetStatistics() const { return _stats; }
+
+	private:
+		struct Stop
+		{
+			uint8_t index;
+			uint8_t present;
+			uint16_t line;
+			char name[IBIS_CIS_TEXT_LENGTH];
+			char destination[IBIS_CIS_TEXT_LENGTH];
+			char connections[IBIS_CIS_TEXT_LENGTH];
+		};
+
+		enum class Markup : uint8_t
+		{
+			Text,
+			TagStart,
+			TagName,
+			EndTagName,
+			Attributes,
+			Bang,
+			Comment,
+			CData,
+			Skip,
+			Entity
+		};
+
+		void Parse(char c);
+		void OpenElement();
+		void CloseElement();
+		void AppendText(char c);
+		void AppendEntity();
+		void HandleValue();
+		uint8_t Commit();
+
+		// Whether an element is open anywhere on the current path
+		bool IsInside(uint8_t element) const;
+		uint8_t GetParent(uint8_t level) const;
+
+		// Markup state
+		Markup _markup;
+		char _name[24];
+		uint8_t _nameLength;
+		char _quote;
+		bool _emptyElement;
+		char _match[8];
+		uint8_t _matchLength;
+
+		uint8_t _stack[IBIS_CIS_MAX_DEPTH];
+		uint8_t _depth;
+		char _text[IBIS_CIS_TEXT_LENGTH];
+		uint8_t _textLength;
+		bool _textTruncated;
+
+		// The document being parsed
+		bool _inDocument;
+		uint8_t _trips;
+		int16_t _currentStopIndex;
+		uint16_t _time;
+		bool _hasTime;
+		Stop _trip; // DisplayContent below TripInformation
+		Stop _stops[IBIS_CIS_MAX_STOPS];
+		uint8_t _stopCount;
+		Stop* _stop; // Open StopPoint, nullptr if none or it didn't fit
+
+		uint8_t _changes;
+		CustomerInformation _state;
+		CustomerInformationStatistics _stats;
+	};
+}
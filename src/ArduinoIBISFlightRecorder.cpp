@@ -0,0 +1,232 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISFlightRecorder.h"
+
+#if __has_include(<LittleFS.h>)
+
+ArduinoIBIS::FlightRecorder::FlightRecorder(fs::FS& fs, const char* directory)
+	: _fs(fs)
+	, _directory(directory)
+	, _blocks{ CaptureBlock(_buffers[0]), CaptureBlock(_buffers[1]) }
+{
+}
+
+bool ArduinoIBIS::FlightRecorder::Begin(Port& port)
+{
+	if (!_fs.exists(_directory) && !_fs.mkdir(_directory))
+	{
+		return false;
+	}
+
+	// Continue after the newest segment of the ring
+	for (uint8_t i = 0; i < IBIS_RECORDER_SEGMENTS; i++)
+	{
+		char path[64];
+		snprintf(path, sizeof(path), "%s/%02u.ibiscap", _directory, i);
+
+		fs::File file = _fs.open(path, "r");
+		CaptureFileHeader header;
+		if (file && file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+			memcmp(header.magic, IBIS_CAPTURE_MAGIC, 8) == 0 && header.sequence > _sequence)
+		{
+			_sequence = header.sequence;
+		}
+	}
+
+	_port = &port;
+	_port->SetCaptureCallback(Capture, this);
+	return true;
+}
+
+void ArduinoIBIS::FlightRecorder::End()
+{
+	if (_port == nullptr)
+	{
+		return;
+	}
+
+	_port->SetCaptureCallback(nullptr);
+	_port = nullptr;
+
+	// The pending block is older than the active one
+	if (_pending)
+	{
+		WriteBlock(_blocks[_active ^ 1]);
+		_pending = false;
+	}
+	if (!_blocks[_active].IsEmpty())
+	{
+		WriteBlock(_blocks[_active]);
+	}
+
+	if (_segment)
+	{
+		_segment.close();
+	}
+}
+
+void ArduinoIBIS::FlightRecorder::SetTime(uint64_t unixMicros)
+{
+	_timeOffset = unixMicros - GetMicros();
+}
+
+void ArduinoIBIS::FlightRecorder::Idle()
+{
+	if (_port == nullptr)
+	{
+		return;
+	}
+
+	// Also keeps the micros() extension going while nothing is recorded
+	GetMicros();
+
+	if (!_pending && !_blocks[_active].IsEmpty() && millis() - _blockStarted >= IBIS_RECORDER_FLUSH_MS)
+	{
+		SwapBlocks();
+	}
+
+	if (!_pending || _port->GetTimeUntilNextDeadline() < IBIS_RECORDER_IDLE_MS)
+	{
+		return;
+	}
+
+	WriteBlock(_blocks[_active ^ 1]);
+	_pending = false;
+}
+
+void ArduinoIBIS::FlightRecorder::Capture(const uint8_t* frame, uint8_t length, uint8_t flags, void* context)
+{
+	FlightRecorder* self = static_cast<FlightRecorder*>(context);
+	uint64_t time = self->_timeOffset + self->GetMicros();
+
+	CaptureBlock* block = &self->_blocks[self->_active];
+	if (block->IsEmpty())
+	{
+		self->_blockStarted = millis();
+	}
+
+	if (!block->Append(time, flags, frame, length))
+	{
+		// Block is full (or the time jumped), unless the previous block is still waiting the frame is lost
+		if (self->_pending)
+		{
+			self->_stats.dropped++;
+			return;
+		}
+
+		self->SwapBlocks();
+		block = &self->_blocks[self->_active];
+		self->_blockStarted = millis();
+		if (!block->Append(time, flags, frame, length))
+		{
+			self->_stats.dropped++;
+			return;
+		}
+	}
+
+	self->_stats.recorded++;
+}
+
+void ArduinoIBIS::FlightRecorder::SwapBlocks()
+{
+	_pending = true;
+	_active ^= 1;
+}
+
+bool ArduinoIBIS::FlightRecorder::WriteBlock(CaptureBlock& block)
+{
+	const uint8_t* data = block.Finish();
+	bool written = false;
+
+	// Start the next segment of the ring when the current one is full, overwriting the oldest one
+	if (!_segment || _segmentBlocks >= IBIS_RECORDER_SEGMENT_BLOCKS)
+	{
+		if (_segment)
+		{
+			_segment.close();
+		}
+
+		_sequence++;
+		char path[64];
+		snprintf(path, sizeof(path), "%s/%02u.ibiscap", _directory, (unsigned)(_sequence % IBIS_RECORDER_SEGMENTS));
+
+		CaptureFileHeader header = {};
+		memcpy(header.magic, IBIS_CAPTURE_MAGIC, 8);
+		header.version = IBIS_CAPTURE_VERSION;
+		header.blockSize = IBIS_CAPTURE_BLOCK_SIZE;
+		header.sequence = _sequence;
+
+		// The header takes a whole block, so every block after it starts on a flash block of its own
+		static const uint8_t padding[64] = {};
+		_segment = _fs.open(path, "w");
+		_segmentBlocks = 0;
+		bool started = _segment && _segment.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+		for (size_t written = sizeof(header); started && written < IBIS_CAPTURE_BLOCK_SIZE; written += sizeof(padding))
+		{
+			size_t length = IBIS_CAPTURE_BLOCK_SIZE - written < sizeof(padding) ? IBIS_CAPTURE_BLOCK_SIZE - written : sizeof(padding);
+			started = _segment.write(padding, length) == length;
+		}
+
+		if (started)
+		{
+			_stats.segmentsStarted++;
+			_stats.bytesWritten += IBIS_CAPTURE_BLOCK_SIZE;
+		}
+		else if (_segment)
+		{
+			_segment.close();
+		}
+	}
+
+	// One write per block, flushed right away so it survives a reset
+	if (_segment && _segment.write(data, IBIS_CAPTURE_BLOCK_SIZE) == IBIS_CAPTURE_BLOCK_SIZE)
+	{
+		_segment.flush();
+		_segmentBlocks++;
+		_stats.blocksWritten++;
+		_stats.bytesWritten += IBIS_CAPTURE_BLOCK_SIZE;
+		written = true;
+	}
+	else
+	{
+		_stats.writeErrors++;
+	}
+
+	// The block is given up on errors, recording goes on
+	block.Reset();
+	return written;
+}
+
+uint64_t ArduinoIBIS::FlightRecorder::GetMicros()
+{
+	uint32_t now = micros();
+	if (now < _lastMicros)
+	{
+		_microsHigh++;
+	}
+	_lastMicros = now;
+	return ((uint64_t)_microsHigh << 32) | now;
+}
+
+#endif
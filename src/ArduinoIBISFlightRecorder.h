@@ -0,0 +1,153 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "ArduinoIBIS.h"
+
+// The flight recorder needs LittleFS (ESP8266, ESP32, RP2040 cores). On other platforms this header is empty
+#if __has_include(<LittleFS.h>)
+#include <LittleFS.h>
+
+// Size of the ring: number of segment files and capture blocks (IBIS_CAPTURE_BLOCK_SIZE) per segment. The default
+// takes 8 x 17 x 4 KB = 544 KB of flash, including the block holding each segment's file header
+#ifndef IBIS_RECORDER_SEGMENTS
+#define IBIS_RECORDER_SEGMENTS 8
+#endif
+#ifndef IBIS_RECORDER_SEGMENT_BLOCKS
+#define IBIS_RECORDER_SEGMENT_BLOCKS 16
+#endif
+
+// A full block is only written when the port has nothing to do for at least this long (erasing a flash sector alone
+// takes tens of milliseconds)
+#ifndef IBIS_RECORDER_IDLE_MS
+#define IBIS_RECORDER_IDLE_MS 50
+#endif
+
+// A partially filled block is written after this long, so a crash on a quiet bus doesn't lose much. It is written as a
+// whole block, so this also sets the flash writes on a quiet bus (see the costs of FlightRecorder)
+#ifndef IBIS_RECORDER_FLUSH_MS
+#define IBIS_RECORDER_FLUSH_MS 60000
+#endif
+
+namespace ArduinoIBIS
+{
+	struct FlightRecorderStatistics
+	{
+		// Frames recorded, and frames dropped because both blocks were waiting to be written
+		uint32_t recorded = 0;
+		uint32_t dropped = 0;
+
+		uint32_t blocksWritten = 0;
+		uint32_t bytesWritten = 0;
+		uint32_t writeErrors = 0;
+		uint32_t segmentsStarted = 0;
+	};
+
+	// Continuously records all sent and received frames into a ring of segment files on LittleFS, to find out what
+	// happened on the bus before a field issue. Segments are capture files (see ArduinoIBISCapture.h), so they can be
+	// copied off the device and read with tools/ibis_capture.cpp.
+	//
+	// Recording never blocks sending: frames are appended to a block in RAM (two 4 KB buffers), and full blocks are
+	// written to flash from Idle() only while the port is idle. If a second block fills up before the first one could
+	// be written, frames are dropped and counted.
+	//
+	// Costs:
+	// - Every frame takes a 6 byte record header plus its wire bytes, e.g. 12 bytes for a DS001 line number ("l123\r"
+	//   and checksum) or 27 bytes for a DS003a destination with 16 characters. Block headers add 48 bytes per block
+	// - Only whole blocks are written, each exactly once. The file header is padded to a block, so with 4 KB flash
+	//   blocks every write covers exactly one of them and LittleFS never has to copy a partly filled one. It only
+	//   adds a small metadata commit per block, plus one header block per segment
+	// - A bus at full load (1200 baud, about 109 bytes/s) fills a block in about 30 s and is recorded with about
+	//   140 bytes/s, about 13 MB per day including the header blocks. Spread over a 1 MB LittleFS partition by its
+	//   wear leveling, that's about 13 erase cycles per flash block and day. With typical 100000 cycles, the flash
+	//   lasts for about 20 years of full load
+	// - A quiet bus costs more than its traffic suggests: a partly filled block is still written as a whole 4 KB block
+	//   every IBIS_RECORDER_FLUSH_MS. With the default of 60 s, that's a floor of about 1530 blocks or 6 MB per day,
+	//   even if only one DS001 (18 bytes) is recorded per minute, a write amplification of about 340. This worst case
+	//   at idle is half the cost of full load, so the flash lifetime is at least about 20 years under any load. Raise
+	//   IBIS_RECORDER_FLUSH_MS to trade the frames lost on a crash for less flash wear
+	//
+	//   LittleFS.begin();
+	//   recorder.Begin(ibis);
+	//
+	//   void loop()
+	//   {
+	//       ibis.Run();
+	//       recorder.Idle();
+	//   }
+	class FlightRecorder
+	{
+	public:
+		explicit FlightRecorder(fs::FS& fs = LittleFS, const char* directory = "/ibis");
+
+		// Starts recording the frames of the port. The file system has to be mounted already. Recording continues in
+		// the segment after the newest one found in the directory
+		bool Begin(Port& port);
+
+		// Stops recording and writes what's left in RAM. This blocks until flash is written, call it before a planned
+		// restart
+		void End();
+
+		// Sets the current time as UNIX time in microseconds (e.g. from NTP or a DS005 time telegram). Until then,
+		// records are stamped with the time since boot
+		void SetTime(uint64_t unixMicros);
+
+		// Writes a waiting block to flash if the port is idle. Call this from loop()
+		void Idle();
+
+		const FlightRecorderStatistics& GetStatistics() const { return _stats; }
+
+	private:
+		static void Capture(const uint8_t* frame, uint8_t length, uint8_t flags, void* context);
+
+		// Hands the active block over to Idle() and continues in the other one
+		void SwapBlocks();
+
+		bool WriteBlock(CaptureBlock& block);
+
+		// Microseconds since boot, extended beyond the 32 bit wrap around of micros()
+		uint64_t GetMicros();
+
+		fs::FS& _fs;
+		const char* _directory;
+		Port* _port = nullptr;
+
+		fs::File _segment;
+		uint32_t _sequence = 0;
+		uint16_t _segmentBlocks = 0;
+
+		alignas(8) uint8_t _buffers[2][IBIS_CAPTURE_BLOCK_SIZE];
+		CaptureBlock _blocks[2];
+		uint8_t _active = 0;
+		bool _pending = false;
+		uint32_t _blockStarted = 0;
+
+		uint64_t _timeOffset = 0;
+		uint32_t _lastMicros = 0;
+		uint32_t _microsHigh = 0;
+
+		FlightRecorderStatistics _stats;
+	};
+}
+
+#endif
@@ -0,0 +1,153 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISFont.h"
+
+// No table needed, every character takes the default width
+const ArduinoIBIS::Font ArduinoIBIS::Fonts::Fixed5x7 = { nullptr, 0, 0, 5, 1 };
+
+static inline uint8_t GetCharacterWidth(const ArduinoIBIS::Font& font, uint8_t character)
+{
+	uint8_t index = character - font.firstCharacter;
+	if (character < font.firstCharacter || index >= font.characterCount)
+	{
+		return font.defaultWidth;
+	}
+
+	return pgm_read_byte(&font.widths[index]);
+}
+
+uint16_t ArduinoIBIS::MeasureText(const Font& font, const char* text, uint16_t length)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	uint16_t width = (length - 1) * font.spacing;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		width += GetCharacterWidth(font, text[i]);
+	}
+
+	return width;
+}
+
+uint16_t ArduinoIBIS::FitText(const Font& font, const char* text, uint16_t length, uint16_t maxWidth)
+{
+	uint16_t width = 0;
+	for (uint16_t i = 0; i < length; i++)
+	{
+		width += GetCharacterWidth(font, text[i]) + (i > 0 ? font.spacing : 0);
+		if (width > maxWidth)
+		{
+			return i;
+		}
+	}
+
+	return length;
+}
+
+uint16_t ArduinoIBIS::FitUTF8Text(const Font* font, const TextEncoding* encoding, const char* text, uint16_t length, uint16_t maxWidth)
+{
+	// Transcode character by character. Without a font, every encoded character takes a column. With one, remember
+	// where the source character of every encoded one starts, and measure them all at once afterwards
+	char encoded[IBIS_METRICS_MAX_LENGTH];
+	uint16_t starts[IBIS_METRICS_MAX_LENGTH];
+	uint8_t count = 0;
+	uint16_t columns = 0;
+	uint16_t end = 0;
+	while (end < length && (font == nullptr || count < IBIS_METRICS_MAX_LENGTH))
+	{
+		uint16_t next = end + 1;
+		while (next < length && (text[next] & 0xC0) == 0x80 && next - end < 4)
+		{
+			next++;
+		}
+
+		char character[5];
+		memcpy(character, text + end, next - end);
+		character[next - end] = '\0';
+		if (font == nullptr)
+		{
+			// A character can become several (e.g. AE) or none (e.g. a soft hyphen)
+			char output[8];
+			uint16_t written = TranscodeText(character, output, sizeof(output), encoding);
+			if (columns + written > maxWidth)
+			{
+				return end;
+			}
+			columns += written;
+		}
+		else
+		{
+			uint16_t written = TranscodeText(character, encoded + count, IBIS_METRICS_MAX_LENGTH - count, encoding);
+			for (uint16_t i = 0; i < written; i++)
+			{
+				starts[count++] = end;
+			}
+		}
+		end = next;
+	}
+	if (font == nullptr)
+	{
+		return end;
+	}
+
+	// Cut before the source character of the first encoded character that doesn't fit
+	TextMetrics metrics;
+	metrics.Compute(*font, encoded, count);
+	uint8_t fitting = metrics.Fit(maxWidth);
+	return fitting < count ? starts[fitting] : end;
+}
+
+void ArduinoIBIS::TextMetrics::Compute(const Font& font, const char* text, uint16_t length)
+{
+	_length = length < IBIS_METRICS_MAX_LENGTH ? length : IBIS_METRICS_MAX_LENGTH;
+	_prefix[0] = 0;
+	for (uint8_t i = 0; i < _length; i++)
+	{
+		_prefix[i + 1] = _prefix[i] + GetCharacterWidth(font, text[i]) + (i > 0 ? font.spacing : 0);
+	}
+}
+
+uint8_t ArduinoIBIS::TextMetrics::Fit(uint16_t maxWidth) const
+{
+	// Find the largest count with _prefix[count] <= maxWidth, the prefix sums are monotonic
+	uint8_t low = 0;
+	uint8_t high = _length;
+	while (low < high)
+	{
+		uint8_t middle = (low + high + 1) / 2;
+		if (_prefix[middle] <= maxWidth)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+
+	return low;
+}
@@ -0,0 +1,89 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <Arduino.h>
+#include "ArduinoIBISCharset.h"
+
+// Longest text (in VDV characters) TextMetrics can hold prefix sums for
+#ifndef IBIS_METRICS_MAX_LENGTH
+#define IBIS_METRICS_MAX_LENGTH 64
+#endif
+
+namespace ArduinoIBIS
+{
+	// Character widths of a proportional display font. Widths are indexed by VDV 300 character (so the umlaut slots
+	// {|}~[\] hold the umlaut widths) and stored in PROGMEM. Characters outside the table count as defaultWidth
+	struct Font
+	{
+		const uint8_t* widths;
+		uint8_t firstCharacter;
+		uint8_t characterCount;
+		uint8_t defaultWidth;
+
+		// Pixels between two characters
+		uint8_t spacing;
+	};
+
+	// Built-in fonts
+	namespace Fonts
+	{
+		// Every character is five pixels wide with one pixel spacing, e.g. for classic 5x7 matrix signs
+		extern const Font Fixed5x7;
+	}
+
+	// Returns the width in pixels of VDV 300 encoded text (see TranscodeText) when rendered in the font
+	uint16_t MeasureText(const Font& font, const char* text, uint16_t length);
+
+	// Returns how many characters of the VDV 300 encoded text fit into maxWidth pixels
+	uint16_t FitText(const Font& font, const char* text, uint16_t length, uint16_t maxWidth);
+
+	// Returns how many bytes of the UTF-8 text fit into maxWidth pixels once transcoded with the encoding, cut at a
+	// character boundary. Without a font, maxWidth is the number of transcoded characters (e.g. Æ takes two). The
+	// text is transcoded and measured once (see TextMetrics), so this is O(n). With a font, at most
+	// IBIS_METRICS_MAX_LENGTH transcoded characters are considered
+	uint16_t FitUTF8Text(const Font* font, const TextEncoding* encoding, const char* text, uint16_t length, uint16_t maxWidth);
+
+	// Precomputed widths of a stored text, so fitting it to different widths is a binary search instead of measuring
+	// it again every time
+	class TextMetrics
+	{
+	public:
+		// Computes the width prefix sums of the VDV 300 encoded text, which is cut at IBIS_METRICS_MAX_LENGTH
+		void Compute(const Font& font, const char* text, uint16_t length);
+
+		// Returns the width of the whole text in pixels
+		uint16_t GetWidth() const { return _prefix[_length]; }
+
+		// Returns the width of the first count characters in pixels
+		uint16_t GetWidth(uint8_t count) const { return _prefix[count <= _length ? count : _length]; }
+
+		// Returns how many characters fit into maxWidth pixels, in O(log n)
+		uint8_t Fit(uint16_t maxWidth) const;
+
+	private:
+		// _prefix[i] is the width of the first i characters (without the spacing after the last one)
+		uint16_t _prefix[IBIS_METRICS_MAX_LENGTH + 1] = {};
+		uint8_t _length = 0;
+	};
+}
@@ -0,0 +1,138 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISFramePool.h"
+
+ArduinoIBIS::FramePool::FramePool()
+{
+	char* storage[IBIS_POOL_CLASSES] = { &_small[0][0], &_medium[0][0], &_large[0][0] };
+	uint8_t* next[IBIS_POOL_CLASSES] = { _smallNext, _mediumNext, _largeNext };
+	uint16_t sizes[IBIS_POOL_CLASSES] = { IBIS_POOL_SMALL_SIZE, IBIS_POOL_MEDIUM_SIZE, IBIS_POOL_LARGE_SIZE };
+	uint8_t counts[IBIS_POOL_CLASSES] = { IBIS_POOL_SMALL_BLOCKS, IBIS_POOL_MEDIUM_BLOCKS, IBIS_POOL_LARGE_BLOCKS };
+
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		SizeClass& sizeClass = _classes[c];
+		sizeClass.storage = storage[c];
+		sizeClass.next = next[c];
+		sizeClass.stats.blockSize = sizes[c];
+		sizeClass.stats.capacity = counts[c];
+
+		// Chain all blocks into the free list
+		for (uint8_t i = 0; i < counts[c]; i++)
+		{
+			sizeClass.next[i] = (i + 1 < counts[c]) ? i + 1 : EndOfList;
+		}
+		sizeClass.freeHead = counts[c] > 0 ? 0 : EndOfList;
+	}
+}
+
+char* ArduinoIBIS::FramePool::Allocate(uint16_t length, uint8_t classes)
+{
+	bool fallback = false;
+	bool excluded = false;
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		SizeClass& sizeClass = _classes[c];
+		if (length > sizeClass.stats.blockSize)
+		{
+			continue;
+		}
+
+		if (!(classes & (1 << c)))
+		{
+			excluded = excluded || sizeClass.freeHead != EndOfList;
+			continue;
+		}
+
+		if (sizeClass.freeHead == EndOfList)
+		{
+			fallback = true;
+			continue;
+		}
+
+		uint8_t index = sizeClass.freeHead;
+		sizeClass.freeHead = sizeClass.next[index];
+
+		sizeClass.stats.allocations++;
+		if (fallback)
+		{
+			sizeClass.stats.fallbacks++;
+		}
+		if (++sizeClass.stats.inUse > sizeClass.stats.highWatermark)
+		{
+			sizeClass.stats.highWatermark = sizeClass.stats.inUse;
+		}
+
+		return sizeClass.storage + (uint16_t)index * sizeClass.stats.blockSize;
+	}
+
+	// Account the failure to the class the frame would have belonged to, unless there was a free block the caller
+	// didn't want
+	if (excluded)
+	{
+		return nullptr;
+	}
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		if (length <= _classes[c].stats.blockSize || c == IBIS_POOL_CLASSES - 1)
+		{
+			_classes[c].stats.exhausted++;
+			break;
+		}
+	}
+	return nullptr;
+}
+
+void ArduinoIBIS::FramePool::Free(char* block)
+{
+	if (block == nullptr)
+	{
+		return;
+	}
+
+	uint8_t c = GetSizeClass(block);
+	if (c >= IBIS_POOL_CLASSES)
+	{
+		return;
+	}
+
+	SizeClass& sizeClass = _classes[c];
+	uint8_t index = (uint16_t)(block - sizeClass.storage) / sizeClass.stats.blockSize;
+	sizeClass.next[index] = sizeClass.freeHead;
+	sizeClass.freeHead = index;
+	sizeClass.stats.inUse--;
+}
+
+uint8_t ArduinoIBIS::FramePool::GetSizeClass(const char* block) const
+{
+	for (uint8_t c = 0; c < IBIS_POOL_CLASSES; c++)
+	{
+		const SizeClass& sizeClass = _classes[c];
+		if (block >= sizeClass.storage && (size_t)(block - sizeClass.storage) < (size_t)sizeClass.stats.capacity * sizeClass.stats.blockSize)
+		{
+			return c;
+		}
+	}
+	return IBIS_POOL_CLASSES;
+}
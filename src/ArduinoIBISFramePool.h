@@ -0,0 +1,113 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <Arduino.h>
+#include "ArduinoIBISTelegram.h"
+
+// Size classes of the frame pool and the number of blocks per class. Short frames are the numeric telegrams (DS001,
+// DS005, ...), medium frames fit a 16 character block text (DS003a, DS009) and large frames a full DS021a
+#ifndef IBIS_POOL_SMALL_SIZE
+#define IBIS_POOL_SMALL_SIZE 16
+#endif
+#ifndef IBIS_POOL_SMALL_BLOCKS
+#define IBIS_POOL_SMALL_BLOCKS 8
+#endif
+#ifndef IBIS_POOL_MEDIUM_SIZE
+#define IBIS_POOL_MEDIUM_SIZE 40
+#endif
+#ifndef IBIS_POOL_MEDIUM_BLOCKS
+#define IBIS_POOL_MEDIUM_BLOCKS 6
+#endif
+#ifndef IBIS_POOL_LARGE_SIZE
+#define IBIS_POOL_LARGE_SIZE IBIS_TELEGRAM_MAX_LENGTH
+#endif
+#ifndef IBIS_POOL_LARGE_BLOCKS
+#define IBIS_POOL_LARGE_BLOCKS 2
+#endif
+
+#define IBIS_POOL_CLASSES 3
+
+namespace ArduinoIBIS
+{
+	// Usage counters of one size class
+	struct FramePoolStatistics
+	{
+		uint16_t blockSize = 0;
+		uint8_t capacity = 0;
+		uint8_t inUse = 0;
+		uint8_t highWatermark = 0;
+		uint32_t allocations = 0;
+
+		// Allocations that had to fall back to a larger class, and allocations that failed because no class had a
+		// free block left
+		uint32_t fallbacks = 0;
+		uint32_t exhausted = 0;
+	};
+
+	// Fixed-block allocator for wire frames. All blocks are allocated statically, Allocate() and Free() are O(1)
+	// (a free list per size class) and never touch the heap. Not interrupt safe, only use it from the loop.
+	// It can't be copied, as the size classes point into its own storage
+	class FramePool
+	{
+	public:
+		FramePool();
+		FramePool(const FramePool&) = delete;
+		FramePool& operator=(const FramePool&) = delete;
+
+		// Returns a block that can hold at least length bytes, or nullptr if the pool is exhausted. Requests are served
+		// from the smallest fitting class and fall back to the next larger one if it's empty. classes is a bit mask of
+		// the size classes the block may come from (bit 0 = small), e.g. to keep a caller within its share of a class
+		char* Allocate(uint16_t length, uint8_t classes = 0xFF);
+
+		// Returns a block obtained from Allocate() to the pool
+		void Free(char* block);
+
+		// Returns the size class a block obtained from Allocate() belongs to, or IBIS_POOL_CLASSES for other pointers
+		uint8_t GetSizeClass(const char* block) const;
+
+		// Returns the counters of a size class (0 = small, 1 = medium, 2 = large)
+		const FramePoolStatistics& GetStatistics(uint8_t sizeClass) const { return _classes[sizeClass].stats; }
+
+	private:
+		struct SizeClass
+		{
+			char* storage = nullptr;
+			uint8_t* next = nullptr;
+			uint8_t freeHead = 0;
+			FramePoolStatistics stats;
+		};
+
+		// Marks the end of a free list
+		static const uint8_t EndOfList = 0xFF;
+
+		SizeClass _classes[IBIS_POOL_CLASSES];
+
+		char _small[IBIS_POOL_SMALL_BLOCKS][IBIS_POOL_SMALL_SIZE];
+		char _medium[IBIS_POOL_MEDIUM_BLOCKS][IBIS_POOL_MEDIUM_SIZE];
+		char _large[IBIS_POOL_LARGE_BLOCKS][IBIS_POOL_LARGE_SIZE];
+		uint8_t _smallNext[IBIS_POOL_SMALL_BLOCKS];
+		uint8_t _mediumNext[IBIS_POOL_MEDIUM_BLOCKS];
+		uint8_t _largeNext[IBIS_POOL_LARGE_BLOCKS];
+	};
+}
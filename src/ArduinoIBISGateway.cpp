@@ -0,0 +1,425 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISGateway.h"
+
+// Splits off the next space separated token, or returns nullptr at the end of the line
+static char* NextToken(char*& cursor)
+{
+	while (*cursor == ' ')
+	{
+		cursor++;
+	}
+	if (*cursor == '\0')
+	{
+		return nullptr;
+	}
+
+	char* token = cursor;
+	while (*cursor != ' ' && *cursor != '\0')
+	{
+		cursor++;
+	}
+	if (*cursor == ' ')
+	{
+		*cursor++ = '\0';
+	}
+	return token;
+}
+
+// Parses a decimal number which has to be the whole token
+static bool ParseNumber(const char* text, uint32_t max, uint32_t& value)
+{
+	if (text == nullptr || *text == '\0')
+	{
+		return false;
+	}
+
+	value = 0;
+	for (; *text != '\0'; text++)
+	{
+		if (*text < '0' || *text > '9')
+		{
+			return false;
+		}
+		value = value * 10 + (*text - '0');
+		if (value > max)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Argument parsers for the simple telegrams, chosen by their argument type
+static bool ParseArgument(char* arguments, uint8_t& value)
+{
+	uint32_t number = 0;
+	bool valid = ParseNumber(NextToken(arguments), 0xFF, number) && NextToken(arguments) == nullptr;
+	value = (uint8_t)number;
+	return valid;
+}
+
+static bool ParseArgument(char* arguments, uint16_t& value)
+{
+	uint32_t number = 0;
+	bool valid = ParseNumber(NextToken(arguments), 0xFFFF, number) && NextToken(arguments) == nullptr;
+	value = (uint16_t)number;
+	return valid;
+}
+
+static bool ParseArgument(char* arguments, const char*& value)
+{
+	value = arguments;
+	return true;
+}
+
+// Splits two texts separated by '|'
+static const char* SplitTexts(char* text)
+{
+	char* separator = strchr(text, '|');
+	if (separator == nullptr)
+	{
+		return nullptr;
+	}
+	*separator = '\0';
+	return separator + 1;
+}
+
+namespace
+{
+	typedef ArduinoIBIS::Telegram (*CommandBuilder)(char* arguments, ArduinoIBIS::Port& port, bool& valid);
+
+	struct Command
+	{
+		const char* name;
+		CommandBuilder build;
+	};
+
+	// One entry per simple telegram, expanded from IBIS_SIMPLE_TELEGRAMS
+	#define IBIS_GATEWAY_COMMAND(id, argType, fmt) \
+		{ "DS" #id, [](char* arguments, ArduinoIBIS::Port& port, bool& valid) \
+		{ \
+			argType value; \
+			valid = ParseArgument(arguments, value); \
+			return valid ? ArduinoIBIS::Port::Build::DS##id(value, port.GetTextEncoding()) : ArduinoIBIS::Telegram(); \
+		} },
+
+	const Command Commands[] =
+	{
+		IBIS_SIMPLE_TELEGRAMS(IBIS_GATEWAY_COMMAND)
+
+		{ "DS010e", [](char* arguments, ArduinoIBIS::Port&, bool& valid)
+		{
+			const char* sign = NextToken(arguments);
+			uint32_t delay;
+			valid = sign != nullptr && (strcmp(sign, "+") == 0 || strcmp(sign, "-") == 0) &&
+				ParseNumber(NextToken(arguments), 999, delay);
+			return valid ? ArduinoIBIS::Port::Build::DS010e(sign, delay) : ArduinoIBIS::Telegram();
+		} },
+		{ "DS003a", [](char* arguments, ArduinoIBIS::Port& port, bool& valid)
+		{
+			valid = true;
+			return ArduinoIBIS::Port::Build::DS003a(arguments, port.GetTextEncoding());
+		} },
+		{ "DS003c", [](char* arguments, ArduinoIBIS::Port& port, bool& valid)
+		{
+			valid = true;
+			return ArduinoIBIS::Port::Build::DS003c(arguments, port.GetTextEncoding());
+		} },
+		{ "DS021", [](char* arguments, ArduinoIBIS::Port& port, bool& valid)
+		{
+			uint32_t address;
+			valid = ParseNumber(NextToken(arguments), 15, address);
+			return valid ? ArduinoIBIS::Port::Build::DS021(address, arguments, port.GetEncoding(address)) : ArduinoIBIS::Telegram();
+		} },
+		{ "DS021a", [](char* arguments, ArduinoIBIS::Port& port, bool& valid)
+		{
+			uint32_t address;
+			uint32_t stopId;
+			valid = ParseNumber(NextToken(arguments), 15, address) && ParseNumber(NextToken(arguments), 0xFF, stopId);
+			const char* changeText = valid ? SplitTexts(arguments) : nullptr;
+			valid = changeText != nullptr;
+			return valid ? ArduinoIBIS::Port::Build::DS021a(address, stopId, arguments, changeText, port.GetEncoding(address)) : ArduinoIBIS::Telegram();
+		} },
+		{ "GSP", [](char* arguments, ArduinoIBIS::Port& port, bool& valid)
+		{
+			uint32_t address;
+			valid = ParseNumber(NextToken(arguments), 15, address);
+			const char* line2 = valid ? SplitTexts(arguments) : nullptr;
+			valid = line2 != nullptr;
+			return valid ? ArduinoIBIS::Port::Build::GSP(address, arguments, line2, port.GetEncoding(address)) : ArduinoIBIS::Telegram();
+		} },
+	};
+
+	#undef IBIS_GATEWAY_COMMAND
+}
+
+ArduinoIBIS::CommandGateway::CommandGateway(Port& port, Stream& stream)
+	: _port(port)
+	, _stream(stream)
+{
+	// Sending right away would block Run() for the wire time of a whole batch
+	_port.SetQueueEnabled(true);
+}
+
+void ArduinoIBIS::CommandGateway::Run()
+{
+	for (uint8_t i = 0; i < IBIS_GATEWAY_BYTES_PER_RUN && _stream.available() > 0; i++)
+	{
+		char value = (char)_stream.read();
+		if (value != '\r' && value != '\n')
+		{
+			if (_lineLength < IBIS_GATEWAY_LINE_LENGTH - 1)
+			{
+				_line[_lineLength++] = value;
+			}
+			else
+			{
+				_lineTooLong = true;
+			}
+			continue;
+		}
+
+		// End of line (CR, LF or both)
+		if (_lineTooLong)
+		{
+			_line[_lineLength] = '\0';
+			char* cursor = _line;
+			uint32_t sequence;
+			bool hasSequence = ParseNumber(NextToken(cursor), 0xFFFF, sequence);
+			Reject(hasSequence ? (int32_t)sequence : -1, "long");
+
+			// The rest of a batch can't be trusted anymore
+			_batchFailed = _batchOpen;
+		}
+		else if (_lineLength > 0)
+		{
+			_line[_lineLength] = '\0';
+			ProcessLine(_line);
+		}
+
+		_lineLength = 0;
+		_lineTooLong = false;
+	}
+}
+
+void ArduinoIBIS::CommandGateway::ProcessLine(char* line)
+{
+	char* cursor = line;
+	uint32_t sequence;
+	if (!ParseNumber(NextToken(cursor), 0xFFFF, sequence))
+	{
+		Reject(-1, "syntax");
+		return;
+	}
+
+	const char* command = NextToken(cursor);
+	if (command == nullptr)
+	{
+		Reject(sequence, "syntax");
+		return;
+	}
+
+	if (strcmp(command, "BEGIN") == 0)
+	{
+		_batchOpen = true;
+		_batchFailed = false;
+		_batchCount = 0;
+		Acknowledge(sequence);
+		return;
+	}
+
+	if (strcmp(command, "ABORT") == 0 || strcmp(command, "COMMIT") == 0)
+	{
+		bool commit = command[0] == 'C';
+		if (!_batchOpen || (commit && _batchFailed))
+		{
+			Reject(sequence, "batch");
+		}
+		else if (commit && !_port.CanSend(_batch, _batchCount, _port.GetSelectedProducer()))
+		{
+			// Nothing is queued unless all of them fit (queue slots, producer quota and frame pool blocks)
+			Reject(sequence, "busy");
+		}
+		else if (commit)
+		{
+			// All of them fit, so this only counts telegrams the port rejects anyway
+			uint8_t sent = 0;
+			for (uint8_t i = 0; i < _batchCount; i++)
+			{
+				if (_port.Send(_batch[i]))
+				{
+					sent++;
+				}
+			}
+
+			_stats.batches++;
+			_stats.commands += _batchCount;
+			Acknowledge(sequence, sent);
+		}
+		else
+		{
+			Acknowledge(sequence);
+		}
+
+		_batchOpen = false;
+		_batchCount = 0;
+		return;
+	}
+
+	// Inside a batch the telegram is built right into its slot
+	Telegram single;
+	Telegram* telegram = &single;
+	if (_batchOpen)
+	{
+		if (_batchCount >= IBIS_GATEWAY_BATCH_SIZE)
+		{
+			_batchFailed = true;
+			Reject(sequence, "batch");
+			return;
+		}
+		telegram = &_batch[_batchCount];
+	}
+
+	const char* error = BuildTelegram(command, cursor, *telegram);
+	if (error != nullptr)
+	{
+		_batchFailed = _batchOpen;
+		Reject(sequence, error);
+		return;
+	}
+
+	if (_batchOpen)
+	{
+		_batchCount++;
+		return;
+	}
+
+	if (_port.GetQueuedCount() >= IBIS_TX_QUEUE_SIZE)
+	{
+		Reject(sequence, "busy");
+		return;
+	}
+
+	if (!_port.Send(single))
+	{
+		Reject(sequence, "busy");
+		return;
+	}
+
+	_stats.commands++;
+	Acknowledge(sequence);
+}
+
+const char* ArduinoIBIS::CommandGateway::BuildTelegram(const char* command, char* arguments, Telegram& telegram)
+{
+	for (const Command& entry : Commands)
+	{
+		if (strcmp(entry.name, command) != 0)
+		{
+			continue;
+		}
+
+		bool valid = false;
+		telegram = entry.build(arguments, _port, valid);
+		if (!valid || !telegram.IsValid())
+		{
+			return "range";
+		}
+		return nullptr;
+	}
+
+	return "unknown";
+}
+
+void ArduinoIBIS::CommandGateway::Acknowledge(int32_t sequence, int16_t count)
+{
+	_stream.print("ACK ");
+	_stream.print(sequence);
+	if (count >= 0)
+	{
+		_stream.print(' ');
+		_stream.print(count);
+	}
+	_stream.print("\r\n");
+}
+
+void ArduinoIBIS::CommandGateway::Reject(int32_t sequence, const char* reason)
+{
+	_stats.rejected++;
+	_stream.print("NAK ");
+	if (sequence >= 0)
+	{
+		_stream.print(sequence);
+	}
+	else
+	{
+		_stream.print('-');
+	}
+	_stream.print(' ');
+	_stream.print(reason);
+	_stream.print("\r\n");
+}
+
+ArduinoIBIS::CustomerInformationGateway::CustomerInformationGateway(Port& port, uint8_t progressAddress)
+	: _port(port)
+	, _progressAddress(progressAddress)
+{
+}
+
+void ArduinoIBIS::CustomerInformationGateway::Feed(const char* data, size_t length)
+{
+	uint8_t changes = _parser.Feed(data, length);
+	if (changes != 0)
+	{
+		Send(changes);
+	}
+}
+
+void ArduinoIBIS::CustomerInformationGateway::Send(uint8_t fields)
+{
+	const CustomerInformation& state = _parser.GetState();
+	const TextEncoding* encoding = _port.GetTextEncoding();
+
+	if (fields & CustomerInformationLine)
+	{
+		_port.Send(Port::Build::DS001(state.line));
+	}
+	if (fields & CustomerInformationDestination)
+	{
+		_port.Send(Port::Build::DS003a(state.destination, encoding));
+	}
+	if (fields & CustomerInformationNextStop)
+	{
+		_port.Send(Port::Build::DS003c(state.stopName, encoding));
+	}
+	if (fields & CustomerInformationProgress)
+	{
+		_port.Send(Port::Build::DS021a(_progressAddress, state.stopIndex, state.stopName, state.connections, _port.GetEncoding(_progressAddress)));
+	}
+	if (fields & CustomerInformationTime)
+	{
+		_port.Send(Port::Build::DS005(state.time));
+	}
+}
@@ -0,0 +1,154 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "ArduinoIBIS.h"
+#include "ArduinoIBISCustomerInformation.h"
+
+// Longest command line (longer lines are rejected), number of telegrams a batch can hold (each takes a full Telegram
+// in RAM) and number of bytes read from the stream per Run() call
+#ifndef IBIS_GATEWAY_LINE_LENGTH
+#define IBIS_GATEWAY_LINE_LENGTH 160
+#endif
+#ifndef IBIS_GATEWAY_BATCH_SIZE
+#define IBIS_GATEWAY_BATCH_SIZE 8
+#endif
+#ifndef IBIS_GATEWAY_BYTES_PER_RUN
+#define IBIS_GATEWAY_BYTES_PER_RUN 64
+#endif
+
+// Address of the line progress display the CustomerInformationGateway sends DS021a to
+#ifndef IBIS_CIS_PROGRESS_ADDRESS
+#define IBIS_CIS_PROGRESS_ADDRESS 1
+#endif
+
+namespace ArduinoIBIS
+{
+	struct CommandGatewayStatistics
+	{
+		uint32_t commands = 0;
+		uint32_t batches = 0;
+		uint32_t rejected = 0;
+	};
+
+	// Accepts telegram commands as text lines from a Stream (e.g. a UART to the vehicle computer) and sends them
+	// through a port, without any heap allocations. Every line starts with a sequence number (0..65535) chosen by the
+	// sender, which is repeated in the answer:
+	//
+	//   17 DS001 123                ->  ACK 17
+	//   18 DS003a Hauptbahnhof      ->  ACK 18
+	//   19 DS021 3 Messe Nord       ->  ACK 19
+	//   20 DS021a 3 5 Rathaus|U1 U2 ->  ACK 20
+	//   21 GSP 2 Line one|Line two  ->  ACK 21
+	//   22 DS010e + 5               ->  ACK 22
+	//   23 DS001 99999              ->  NAK 23 range
+	//
+	// Commands are named like the Port functions, all simple telegrams (DS001 ... DS010d) take their single argument.
+	// Texts are the rest of the line, two texts are separated by '|'.
+	//
+	// A batch collects several commands and sends them all at once, e.g. a complete set for the next stop. Commands in
+	// a batch are checked right away but not answered unless they're rejected. COMMIT sends all of them if none was
+	// rejected and the transmit queue has room for all of them (slots, producer quota and frame pool blocks), and
+	// answers with the number of telegrams sent. Otherwise none of them is sent:
+	//
+	//   30 BEGIN                    ->  ACK 30
+	//   31 DS003c Rathaus
+	//   32 DS021a 3 5 Rathaus|U1
+	//   33 COMMIT                   ->  ACK 33 2
+	//
+	// ABORT discards a batch. Reasons for a NAK are syntax, unknown (command), range (bad argument), long (line too
+	// long), busy (transmit queue or frame pool full) and batch (no batch open, batch full or a command in it was
+	// rejected).
+	//
+	// The gateway turns on the port's transmit queue (see Port::SetQueueEnabled), so Run() never waits for the wire
+	class CommandGateway
+	{
+	public:
+		CommandGateway(Port& port, Stream& stream);
+
+		// Reads and processes what arrived on the stream. Call this from loop()
+		void Run();
+
+		const CommandGatewayStatistics& GetStatistics() const { return _stats; }
+
+	private:
+		void ProcessLine(char* line);
+
+		// Builds the telegram for a command. Returns nullptr on success, or the reason why it was rejected
+		const char* BuildTelegram(const char* command, char* arguments, Telegram& telegram);
+
+		// Writes the answers. A sequence of -1 is written as '-' (for lines without a valid one), a count of -1 is left out
+		void Acknowledge(int32_t sequence, int16_t count = -1);
+		void Reject(int32_t sequence, const char* reason);
+
+		Port& _port;
+		Stream& _stream;
+
+		char _line[IBIS_GATEWAY_LINE_LENGTH];
+		uint16_t _lineLength = 0;
+		bool _lineTooLong = false;
+
+		Telegram _batch[IBIS_GATEWAY_BATCH_SIZE];
+		uint8_t _batchCount = 0;
+		bool _batchOpen = false;
+		bool _batchFailed = false;
+
+		CommandGatewayStatistics _stats;
+	};
+
+	// Translates VDV 301 CustomerInformationService documents (e.g. from an IBIS-IP on-board computer) into telegrams
+	// for VDV 300 signs. The documents are parsed while they arrive (see CustomerInformationParser), and only the
+	// telegrams for fields which changed are sent:
+	//
+	//   line number             -> DS001
+	//   destination             -> DS003a
+	//   current stop name       -> DS003c
+	//   stop, name, connections -> DS021a to the line progress display
+	//   time (HHMM)             -> DS005
+	//
+	// An unchanged document sends nothing, so the bus load follows what actually changes and not how often the
+	// on-board computer sends. Getting the documents (HTTP polling or subscription) is up to the application
+	class CustomerInformationGateway
+	{
+	public:
+		CustomerInformationGateway(Port& port, uint8_t progressAddress = IBIS_CIS_PROGRESS_ADDRESS);
+
+		// Parses the next piece of input, and sends the telegrams for the documents completed by it
+		void Feed(const char* data, size_t length);
+
+		// Sends all known fields again, e.g. after a sign was switched on
+		void Refresh() { Send(_parser.GetState().present); }
+
+		// Drops a partially fed document, e.g. after the connection it came from broke
+		void Reset() { _parser.Reset(); }
+
+		const CustomerInformationParser& GetParser() const { return _parser; }
+
+	private:
+		void Send(uint8_t fields);
+
+		Port& _port;
+		uint8_t _progressAddress;
+		CustomerInformationParser _parser;
+	};
+}
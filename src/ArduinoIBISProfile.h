@@ -0,0 +1,81 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+// Build profiles, trading flash for speed in the encoder (transcoder, hex digits, framing and checksum). Without a
+// profile, the encoder is balanced between both. IBIS_PROFILE_SIZE suits small boards like the ATmega328, where flash
+// runs out before CPU time does, IBIS_PROFILE_SPEED suits boards which encode many telegrams (e.g. gateways on an
+// ESP32). A profile only picks the defaults of the options below, each of them can still be set on its own.
+// Like all options, they have to be set for the whole build (e.g. build_flags = -DIBIS_PROFILE_SIZE in PlatformIO)
+#if defined(IBIS_PROFILE_SIZE) && defined(IBIS_PROFILE_SPEED)
+#error "ArduinoIBIS: IBIS_PROFILE_SIZE and IBIS_PROFILE_SPEED can't be combined"
+#endif
+
+// Whether Latin Extended-A (U+0100..U+017F, e.g. Polish and Czech letters) is transliterated. Without, those
+// characters become '?' and the transliteration table is 256 bytes smaller
+#ifndef IBIS_TRANSLITERATE_EXTENDED
+#ifdef IBIS_PROFILE_SIZE
+#define IBIS_TRANSLITERATE_EXTENDED 0
+#else
+#define IBIS_TRANSLITERATE_EXTENDED 1
+#endif
+#endif
+
+// Whether typographic punctuation (dashes, curly quotes, ellipsis, euro sign) is transliterated. Without, it becomes '?'
+#ifndef IBIS_TRANSLITERATE_PUNCTUATION
+#ifdef IBIS_PROFILE_SIZE
+#define IBIS_TRANSLITERATE_PUNCTUATION 0
+#else
+#define IBIS_TRANSLITERATE_PUNCTUATION 1
+#endif
+#endif
+
+// Whether the transcoding loop is instantiated twice, so devices without charset don't pay for the check per byte
+#ifndef IBIS_TRANSCODE_SPECIALIZED
+#ifdef IBIS_PROFILE_SIZE
+#define IBIS_TRANSCODE_SPECIALIZED 0
+#else
+#define IBIS_TRANSCODE_SPECIALIZED 1
+#endif
+#endif
+
+// Whether the simple telegrams are encoded by own code instead of vsnprintf(), and the checksum is calculated four
+// bytes at a time. The text telegrams still use vsnprintf(), so this only adds flash
+#ifndef IBIS_FAST_ENCODER
+#ifdef IBIS_PROFILE_SPEED
+#define IBIS_FAST_ENCODER 1
+#else
+#define IBIS_FAST_ENCODER 0
+#endif
+#endif
+
+// Marks the encoder's hot functions. The speed profile compiles them with -O2 (inlining and unrolling), even though
+// Arduino cores build for size with -Os
+#ifndef IBIS_HOT
+#if defined(IBIS_PROFILE_SPEED) && defined(__GNUC__) && !defined(__clang__)
+#define IBIS_HOT __attribute__((optimize("O2")))
+#else
+#define IBIS_HOT
+#endif
+#endif
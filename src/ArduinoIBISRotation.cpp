@@ -0,0 +1,117 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISRotation.h"
+
+bool ArduinoIBIS::Rotation::SetVariant(uint8_t sign, uint8_t language, Telegram&& telegram)
+{
+	if (sign >= IBIS_ROTATION_MAX_SIGNS || language >= IBIS_ROTATION_MAX_LANGUAGES)
+	{
+		return false;
+	}
+
+	_variants[sign][language] = static_cast<Telegram&&>(telegram);
+	return true;
+}
+
+void ArduinoIBIS::Rotation::ClearSign(uint8_t sign)
+{
+	if (sign < IBIS_ROTATION_MAX_SIGNS)
+	{
+		for (uint8_t language = 0; language < IBIS_ROTATION_MAX_LANGUAGES; language++)
+		{
+			_variants[sign][language] = Telegram();
+		}
+	}
+}
+
+void ArduinoIBIS::Rotation::SetDwell(uint8_t language, uint32_t dwellMs)
+{
+	if (language < IBIS_ROTATION_MAX_LANGUAGES)
+	{
+		_dwell[language] = dwellMs;
+	}
+}
+
+bool ArduinoIBIS::Rotation::Start(Port& port)
+{
+	Stop();
+
+	// Begin with the first language that has a dwell time
+	_language = GetNextLanguage(IBIS_ROTATION_MAX_LANGUAGES - 1);
+	if (_dwell[_language] == 0)
+	{
+		return false;
+	}
+
+	_port = &port;
+	Show();
+	return _timer >= 0;
+}
+
+void ArduinoIBIS::Rotation::Stop()
+{
+	if (_port != nullptr && _timer >= 0)
+	{
+		_port->RemoveTimer(_timer);
+	}
+
+	_port = nullptr;
+	_timer = -1;
+}
+
+void ArduinoIBIS::Rotation::Show()
+{
+	for (uint8_t sign = 0; sign < IBIS_ROTATION_MAX_SIGNS; sign++)
+	{
+		const Telegram& telegram = _variants[sign][_language];
+		if (telegram.IsValid())
+		{
+			_port->Send(telegram);
+		}
+	}
+
+	// Dwell times differ per language, so every step is a one-shot timer
+	_timer = _port->AddTimer(_dwell[_language], OnTimer, this, false);
+}
+
+void ArduinoIBIS::Rotation::OnTimer(Port&, void* context)
+{
+	Rotation* rotation = static_cast<Rotation*>(context);
+	rotation->_language = rotation->GetNextLanguage(rotation->_language);
+	rotation->Show();
+}
+
+uint8_t ArduinoIBIS::Rotation::GetNextLanguage(uint8_t language) const
+{
+	for (uint8_t i = 1; i <= IBIS_ROTATION_MAX_LANGUAGES; i++)
+	{
+		uint8_t next = (language + i) % IBIS_ROTATION_MAX_LANGUAGES;
+		if (_dwell[next] > 0)
+		{
+			return next;
+		}
+	}
+
+	return language;
+}
@@ -0,0 +1,83 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include "ArduinoIBIS.h"
+
+// Number of signs (telegrams) and languages a rotation can hold. Every combination stores a full Telegram
+#ifndef IBIS_ROTATION_MAX_SIGNS
+#define IBIS_ROTATION_MAX_SIGNS 4
+#endif
+#ifndef IBIS_ROTATION_MAX_LANGUAGES
+#define IBIS_ROTATION_MAX_LANGUAGES 3
+#endif
+
+namespace ArduinoIBIS
+{
+	// Rotates the texts of several signs through language variants (e.g. German and English destinations), all signs
+	// switching at the same time. The variants are prebuilt telegrams, so a rotation step only sends (or queues, see
+	// Port::SetQueueEnabled) the telegrams of the next language, one after another in the same Run() call
+	class Rotation
+	{
+	public:
+		// Stops rotating, so the port's timer doesn't outlive the rotation
+		~Rotation() { Stop(); }
+
+		// Sets the telegram a sign shows in the given language. Signs without a variant for a language keep showing
+		// what they showed before. Returns false if sign or language are out of range
+		bool SetVariant(uint8_t sign, uint8_t language, Telegram&& telegram);
+
+		// Removes all variants of a sign
+		void ClearSign(uint8_t sign);
+
+		// Sets how long a language is shown before switching to the next one. Languages with a dwell time of 0 are
+		// skipped. As all signs switch together, the dwell time applies to all of them
+		void SetDwell(uint8_t language, uint32_t dwellMs);
+
+		// Shows the first language right away and starts rotating on the port's scheduler. Returns false if no
+		// language has a dwell time or there's no free timer
+		bool Start(Port& port);
+
+		// Stops rotating, the signs keep showing the current language
+		void Stop();
+
+		// Returns the language currently shown
+		uint8_t GetCurrentLanguage() const { return _language; }
+
+	private:
+		// Sends the variants of the current language and schedules the next step
+		void Show();
+		static void OnTimer(Port& port, void* context);
+
+		// Returns the next language with a dwell time after the given one
+		uint8_t GetNextLanguage(uint8_t language) const;
+
+	private:
+		Telegram _variants[IBIS_ROTATION_MAX_SIGNS][IBIS_ROTATION_MAX_LANGUAGES];
+		uint32_t _dwell[IBIS_ROTATION_MAX_LANGUAGES] = {};
+
+		Port* _port = nullptr;
+		int8_t _timer = -1;
+		uint8_t _language = 0;
+	};
+}
@@ -0,0 +1,298 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "ArduinoIBISTelegram.h"
+#include <stdarg.h>
+
+ArduinoIBIS::Telegram& ArduinoIBIS::Telegram::operator=(Telegram&& other)
+{
+	if (this == &other)
+	{
+		return *this;
+	}
+
+	// Only the used part of the buffer needs to be carried over
+	memcpy(_data, other._data, other._length);
+	_length = other._length;
+	_overflow = other._overflow;
+	_finished = other._finished;
+	return *this;
+}
+
+// Parses a format string with a single conversion and nothing after it, like "lE%02d" or "v%-16s". The flag is '0',
+// '-' or '\0' for none. Returns false for anything else, which is then left to vsnprintf()
+static bool ParseField(const char* fmt, char conversion, uint8_t& prefixLength, uint16_t& width, char& flag)
+{
+	const char* percent = strchr(fmt, '%');
+	if (percent == nullptr || percent - fmt >= IBIS_TELEGRAM_MAX_LENGTH)
+	{
+		return false;
+	}
+
+	prefixLength = percent - fmt;
+	const char* spec = percent + 1;
+	flag = *spec == '0' || *spec == '-' ? *spec++ : '\0';
+	width = 0;
+	while (*spec >= '0' && *spec <= '9' && width < IBIS_TELEGRAM_MAX_LENGTH)
+	{
+		width = width * 10 + (*spec++ - '0');
+	}
+
+	return spec[0] == conversion && spec[1] == '\0';
+}
+
+#if IBIS_FAST_ENCODER
+// Writes the field into buf behind the prefix, padded to width like printf() does. Returns the length of the formatted
+// text, or -1 if it doesn't fit
+static int FormatPadded(char* buf, const char* fmt, uint8_t prefixLength, uint16_t width, char flag, const char* field, uint16_t fieldLength)
+{
+	uint16_t padding = fieldLength < width ? width - fieldLength : 0;
+	uint16_t length = prefixLength + padding + fieldLength;
+	if (length >= IBIS_TELEGRAM_MAX_LENGTH)
+	{
+		return -1;
+	}
+
+	memcpy(buf, fmt, prefixLength);
+	char* out = buf + prefixLength;
+	if (flag != '-')
+	{
+		memset(out, flag == '0' ? '0' : ' ', padding);
+		out += padding;
+	}
+	memcpy(out, field, fieldLength);
+	out += fieldLength;
+	if (flag == '-')
+	{
+		memset(out, ' ', padding);
+		out += padding;
+	}
+	*out = '\0';
+
+	return length;
+}
+#endif
+
+ArduinoIBIS::Telegram ArduinoIBIS::Telegram::Format(const TextEncoding* encoding, const char* fmt, ...)
+{
+	char buf[IBIS_TELEGRAM_MAX_LENGTH];
+	va_list args;
+	va_start(args, fmt);
+	int length = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+
+	return FromFormatted(buf, length, encoding);
+}
+
+IBIS_HOT ArduinoIBIS::Telegram ArduinoIBIS::Telegram::FormatField(const TextEncoding* encoding, const char* fmt, uint16_t value)
+{
+#if IBIS_FAST_ENCODER
+	uint8_t prefixLength;
+	uint16_t width;
+	char flag;
+	if (ParseField(fmt, 'd', prefixLength, width, flag))
+	{
+		// Digits from the back, two at a time
+		static const char digitPairs[] PROGMEM =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+
+		char digits[5];
+		char* first = digits + sizeof(digits);
+		while (value >= 10)
+		{
+			uint8_t pair = value % 100;
+			first -= 2;
+			first[0] = pgm_read_byte(&digitPairs[pair * 2]);
+			first[1] = pgm_read_byte(&digitPairs[pair * 2 + 1]);
+			value /= 100;
+		}
+		if (value > 0 || first == digits + sizeof(digits))
+		{
+			*--first = '0' + value;
+		}
+
+		char buf[IBIS_TELEGRAM_MAX_LENGTH];
+		int length = FormatPadded(buf, fmt, prefixLength, width, flag, first, digits + sizeof(digits) - first);
+		return FromFormatted(buf, length, encoding);
+	}
+#endif
+
+	return Format(encoding, fmt, value);
+}
+
+IBIS_HOT ArduinoIBIS::Telegram ArduinoIBIS::Telegram::FormatField(const TextEncoding* encoding, const char* fmt, const char* value)
+{
+	uint8_t prefixLength;
+	uint16_t width;
+	char flag;
+	if (!ParseField(fmt, 's', prefixLength, width, flag) || flag == '0')
+	{
+		return Format(encoding, fmt, value);
+	}
+
+	// The text is padded after transcoding, so the width counts the characters on the wire, not the UTF-8 bytes
+	// ("Müller" and "Muller" both get 10 spaces in a 16 character field). The prefix is plain ASCII, which transcodes
+	// to exactly one byte per character, so it ends right at the conversion
+	Telegram telegram;
+	if (prefixLength > telegram.GetRemaining())
+	{
+		telegram._overflow = true;
+		telegram.Finish();
+		return telegram;
+	}
+	telegram._length = TranscodeText(fmt, telegram._data, prefixLength, encoding);
+
+	char text[IBIS_TELEGRAM_MAX_LENGTH];
+	uint16_t length = TranscodeText(value, text, sizeof(text), encoding);
+	char space;
+	TranscodeText(" ", &space, 1, encoding);
+
+	uint16_t padding = length < width ? width - length : 0;
+	if (flag != '-')
+	{
+		telegram.AppendPadding(padding, space);
+	}
+	telegram.Append(text, length);
+	if (flag == '-')
+	{
+		telegram.AppendPadding(padding, space);
+	}
+
+	telegram.Finish();
+	return telegram;
+}
+
+ArduinoIBIS::Telegram ArduinoIBIS::Telegram::FromFormatted(const char* text, int length, const TextEncoding* encoding)
+{
+	Telegram telegram;
+	if (length < 0 || length >= IBIS_TELEGRAM_MAX_LENGTH)
+	{
+		telegram._overflow = true;
+	}
+	else
+	{
+		telegram._length = TranscodeText(text, telegram._data, telegram.GetRemaining(), encoding);
+	}
+
+	telegram.Finish();
+	return telegram;
+}
+
+IBIS_HOT void ArduinoIBIS::Telegram::Append(char value)
+{
+	if (_finished)
+	{
+		return;
+	}
+
+	if (GetRemaining() == 0)
+	{
+		_overflow = true;
+		return;
+	}
+
+	_data[_length++] = value;
+}
+
+void ArduinoIBIS::Telegram::Append(const char* data, uint16_t length)
+{
+	if (_finished)
+	{
+		return;
+	}
+
+	if (length > GetRemaining())
+	{
+		_overflow = true;
+		length = GetRemaining();
+	}
+
+	memcpy(_data + _length, data, length);
+	_length += length;
+}
+
+void ArduinoIBIS::Telegram::AppendHex(uint8_t value)
+{
+	// The VDV hex digits 0123456789:;<=>? are consecutive in ASCII, so no table is needed
+	uint8_t highNibble = value >> 4;
+	uint8_t lowNibble = value & 15;
+
+	if (highNibble > 0)
+	{
+		Append('0' + highNibble);
+	}
+
+	Append('0' + lowNibble);
+}
+
+void ArduinoIBIS::Telegram::AppendPadding(uint16_t count, char padding)
+{
+	if (_finished)
+	{
+		return;
+	}
+
+	if (count > GetRemaining())
+	{
+		_overflow = true;
+		count = GetRemaining();
+	}
+
+	memset(_data + _length, padding, count);
+	_length += count;
+}
+
+IBIS_HOT void ArduinoIBIS::Telegram::Finish()
+{
+	if (_finished)
+	{
+		return;
+	}
+
+	// Add a CR character at the end (GetRemaining() always keeps room for CR and checksum)
+	_data[_length++] = '\x0d';
+
+	// Calculate the telegram checksum by XOR-ing every byte, starting at 0x7F, and append it to the telegram
+	char checksum = 0x7F;
+	uint16_t i = 0;
+#if IBIS_FAST_ENCODER
+	// Four bytes at a time, then the bytes of the result are folded into the checksum
+	uint32_t wide = 0;
+	for (; i + 4 <= _length; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, _data + i, sizeof(word));
+		wide ^= word;
+	}
+	checksum ^= (char)(wide ^ (wide >> 8) ^ (wide >> 16) ^ (wide >> 24));
+#endif
+	for (; i < _length; i++)
+	{
+		checksum ^= _data[i];
+	}
+	_data[_length++] = checksum;
+
+	_finished = true;
+}
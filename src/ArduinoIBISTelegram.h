@@ -0,0 +1,91 @@
+﻿// ArduinoIBIS
+// Implementation of the VDV 300 IBIS Wagenbus protocol for Arduino and Arduino-core based devices
+
+// Copyright (c) 2025 Jonathan Verbeek
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+#include <Arduino.h>
+#include "ArduinoIBISCharset.h"
+
+// Longest wire frame (including CR and checksum) a telegram can hold. Longer texts are cut at a block boundary
+#ifndef IBIS_TELEGRAM_MAX_LENGTH
+#define IBIS_TELEGRAM_MAX_LENGTH 128
+#endif
+
+namespace ArduinoIBIS
+{
+	// A fully encoded telegram, holding the final wire bytes (including CR and checksum) inline. Telegrams are built by
+	// the encoders in Port::Build and can be sent any number of times with Port::Send(), so the encoding cost is paid
+	// only once. They are move-only, as copying one is almost never intended
+	class Telegram
+	{
+	public:
+		Telegram() = default;
+		Telegram(Telegram&& other) { *this = static_cast<Telegram&&>(other); }
+		Telegram& operator=(Telegram&& other);
+		Telegram(const Telegram&) = delete;
+		Telegram& operator=(const Telegram&) = delete;
+
+		// Builds a telegram from a format string, with the formatted text transcoded to the VDV character set
+		static Telegram Format(const TextEncoding* encoding, const char* fmt, ...);
+
+		// Builds a telegram from a format string with a single number or text field, as used by the simple telegrams.
+		// Text fields ("%-16s") are padded to their width after transcoding, so the width is in wire characters. With
+		// IBIS_FAST_ENCODER, plain number fields ("%03d") are formatted without vsnprintf()
+		static Telegram FormatField(const TextEncoding* encoding, const char* fmt, uint16_t value);
+		static Telegram FormatField(const TextEncoding* encoding, const char* fmt, const char* value);
+
+		// The wire bytes, only complete once the telegram is finished
+		const char* GetData() const { return _data; }
+		uint16_t GetLength() const { return _length; }
+
+		// Whether the telegram is finished and everything fit in
+		bool IsValid() const { return _finished && !_overflow; }
+
+	public:
+		// Appends raw bytes to the payload. Once the telegram is finished, appending has no effect
+		void Append(char value);
+		void Append(const char* data, uint16_t length);
+
+		// Appends a value as VDV hex digits (see VDV 300 page 50): 0..9 are used as-is, A..F are encoded as :;<=>?
+		// The high digit is left out if it's zero
+		void AppendHex(uint8_t value);
+
+		// Appends the padding character count times
+		void AppendPadding(uint16_t count, char padding = ' ');
+
+		// Returns how many payload bytes can still be appended, 0 once the telegram is finished
+		uint16_t GetRemaining() const { return _finished ? 0 : IBIS_TELEGRAM_MAX_LENGTH - 2 - _length; }
+
+		// Adds the CR and checksum, after which the telegram is ready to be sent. Further calls have no effect
+		void Finish();
+
+	private:
+		// Transcodes formatted text of the given length and finishes the telegram, or marks it as overflown if the
+		// text didn't fit into the format buffer (length is negative or at least IBIS_TELEGRAM_MAX_LENGTH)
+		static Telegram FromFormatted(const char* text, int length, const TextEncoding* encoding);
+
+		char _data[IBIS_TELEGRAM_MAX_LENGTH];
+		uint16_t _length = 0;
+		bool _overflow = false;
+		bool _finished = false;
+	};
+}
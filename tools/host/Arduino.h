@@ -0,0 +1,148 @@
+// ArduinoIBIS
+// Host tool header: the parts of the Arduino core the library uses, so its sources build on a PC (Linux)
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// Only meant for the host tools which run telegrams through the library itself (e.g. ibis_vdv301.cpp). Add
+// -I tools/host before -I src to the build. Serial writes to stdout, the clock is the monotonic clock of the PC and
+// pins read as idle (high).
+
+#pragma once
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#define PROGMEM
+#define DEC 10
+#define HEX 16
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+
+inline void* memcpy_P(void* destination, const void* source, size_t length) { return memcpy(destination, source, length); }
+inline uint8_t pgm_read_byte(const void* address) { return *(const uint8_t*)address; }
+inline uint16_t pgm_read_word(const void* address) { return *(const uint16_t*)address; }
+inline const void* pgm_read_ptr(const void* address) { return *(const void* const*)address; }
+
+inline unsigned long micros()
+{
+	static const auto start = std::chrono::steady_clock::now();
+	return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+inline unsigned long millis() { return micros() / 1000; }
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void delayMicroseconds(unsigned int us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+inline void yield() {}
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return HIGH; }
+
+class String
+{
+public:
+	String() {}
+	String(const char* text) : _text(text != nullptr ? text : "") {}
+	String(const std::string& text) : _text(text) {}
+
+	unsigned int length() const { return _text.size(); }
+	const char* c_str() const { return _text.c_str(); }
+	char charAt(unsigned int index) const { return _text[index]; }
+	char operator[](unsigned int index) const { return _text[index]; }
+
+	bool concat(const char* text) { _text += text; return true; }
+	bool concat(const char* text, unsigned int length) { _text.append(text, length); return true; }
+	bool concat(const String& text) { _text += text._text; return true; }
+	bool concat(char value) { _text += value; return true; }
+	String& operator+=(char value) { _text += value; return *this; }
+
+	String substring(unsigned int from, unsigned int to) const
+	{
+		return from <= _text.size() ? String(_text.substr(from, to - from)) : String();
+	}
+
+	void replace(const String& find, const String& replacement)
+	{
+		for (size_t position = 0; (position = _text.find(find._text, position)) != std::string::npos; position += replacement._text.size())
+		{
+			_text.replace(position, find._text.size(), replacement._text);
+		}
+	}
+
+private:
+	std::string _text;
+};
+
+class Print
+{
+public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t value) = 0;
+	virtual size_t write(const uint8_t* data, size_t length)
+	{
+		size_t written = 0;
+		while (length-- > 0)
+		{
+			written += write(*data++);
+		}
+		return written;
+	}
+	size_t write(const char* data, size_t length) { return write((const uint8_t*)data, length); }
+
+	size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+	size_t print(const String& text) { return print(text.c_str()); }
+	size_t print(char value) { return write((uint8_t)value); }
+	size_t print(long value, int base = DEC) { return PrintFormatted(base == HEX ? "%lX" : "%ld", value); }
+	size_t print(unsigned long value, int base = DEC) { return PrintFormatted(base == HEX ? "%lX" : "%lu", value); }
+	size_t print(int value, int base = DEC) { return print((long)value, base); }
+	size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+	size_t print(double value, int digits = 2)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), "%.*f", digits, value);
+		return print(text);
+	}
+
+	size_t println() { return print("\r\n"); }
+	template <typename T> size_t println(T value) { return print(value) + println(); }
+	template <typename T> size_t println(T value, int format) { return print(value, format) + println(); }
+
+	virtual void flush() {}
+	virtual int availableForWrite() { return 0; }
+
+private:
+	template <typename T> size_t PrintFormatted(const char* format, T value)
+	{
+		char text[32];
+		snprintf(text, sizeof(text), format, value);
+		return print(text);
+	}
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+class HostSerial : public Stream
+{
+public:
+	size_t write(uint8_t value) override { return fputc(value, stdout) != EOF; }
+	using Print::write;
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int peek() override { return -1; }
+};
+
+inline HostSerial Serial;
@@ -0,0 +1,37 @@
+// ArduinoIBIS
+// Host tool header: a SoftwareSerial stand-in for the host tools (see Arduino.h next to it)
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// There's no bus behind it: written bytes are dropped (tools see the frames through Port::SetCaptureCallback) and
+// nothing is ever received.
+
+#pragma once
+#include <Arduino.h>
+
+enum SoftwareSerialConfig
+{
+	SWSERIAL_7E2
+};
+
+namespace EspSoftwareSerial
+{
+	class UART : public Stream
+	{
+	public:
+		UART(int8_t, int8_t, bool = false) {}
+
+		void begin(uint32_t, SoftwareSerialConfig) {}
+		void end() {}
+		explicit operator bool() const { return true; }
+		bool operator==(bool value) const { return value; }
+
+		size_t write(uint8_t) override { return 1; }
+		size_t write(const uint8_t*, size_t length) override { return length; }
+		using Print::write;
+		int available() override { return 0; }
+		int read() override { return -1; }
+		int peek() override { return -1; }
+	};
+}
@@ -0,0 +1,479 @@
+// ArduinoIBIS
+// Host tool: scans raw IBIS wagenbus captures, validates checksums and prints per-telegram-type statistics
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// A raw capture is the plain byte stream recorded from the bus (e.g. with a USB serial adapter at 1200 7E2):
+// telegrams terminated by CR, each followed by its XOR checksum byte (see Telegram::Finish).
+//
+// The file is memory-mapped and processed in three steps:
+//   1. All threads search their part of the file for CR bytes (AVX2 or SSE2 where available, scalar otherwise)
+//   2. The CR positions are walked once to find the frame boundaries (a CR right after a frame is its checksum)
+//   3. All threads validate the checksums (same SIMD paths) and count their frames per type
+//
+// Build: g++ -O2 -std=c++17 -pthread tools/ibis_analyze.cpp -o ibis_analyze
+// Usage: ibis_analyze [-j threads] [--errors] [--scalar] capture.bin...
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IBIS_X86 1
+#endif
+
+// Frames longer than this can't be IBIS telegrams, they're counted as garbage (e.g. noise or a wrong baud rate)
+static const size_t MaxFrameLength = 256;
+
+// Scalar fallback for finding CR bytes
+static void FindCRScalar(const uint8_t* data, size_t begin, size_t end, std::vector<uint32_t>& out)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		if (data[i] == '\r')
+		{
+			out.push_back((uint32_t)i);
+		}
+	}
+}
+
+// XOR of all bytes, scalar fallback
+static uint8_t XorScalar(const uint8_t* data, size_t length)
+{
+	uint8_t value = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		value ^= data[i];
+	}
+	return value;
+}
+
+#ifdef IBIS_X86
+static void FindCRSSE2(const uint8_t* data, size_t begin, size_t end, std::vector<uint32_t>& out)
+{
+	const __m128i cr = _mm_set1_epi8('\r');
+	size_t i = begin;
+	for (; i + 16 <= end; i += 16)
+	{
+		uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(data + i)), cr));
+		while (mask != 0)
+		{
+			out.push_back((uint32_t)(i + __builtin_ctz(mask)));
+			mask &= mask - 1;
+		}
+	}
+	FindCRScalar(data, i, end, out);
+}
+
+static uint8_t XorSSE2(const uint8_t* data, size_t length)
+{
+	__m128i accumulator = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16)
+	{
+		accumulator = _mm_xor_si128(accumulator, _mm_loadu_si128((const __m128i*)(data + i)));
+	}
+
+	uint8_t lanes[16];
+	_mm_storeu_si128((__m128i*)lanes, accumulator);
+	return XorScalar(lanes, 16) ^ XorScalar(data + i, length - i);
+}
+
+__attribute__((target("avx2"))) static void FindCRAVX2(const uint8_t* data, size_t begin, size_t end, std::vector<uint32_t>& out)
+{
+	const __m256i cr = _mm256_set1_epi8('\r');
+	size_t i = begin;
+	for (; i + 32 <= end; i += 32)
+	{
+		uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), cr));
+		while (mask != 0)
+		{
+			out.push_back((uint32_t)(i + __builtin_ctz(mask)));
+			mask &= mask - 1;
+		}
+	}
+	FindCRScalar(data, i, end, out);
+}
+
+__attribute__((target("avx2"))) static uint8_t XorAVX2(const uint8_t* data, size_t length)
+{
+	__m256i accumulator = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		accumulator = _mm256_xor_si256(accumulator, _mm256_loadu_si256((const __m256i*)(data + i)));
+	}
+
+	uint8_t lanes[32];
+	_mm256_storeu_si256((__m256i*)lanes, accumulator);
+	return XorScalar(lanes, 32) ^ XorScalar(data + i, length - i);
+}
+#endif
+
+// The implementations picked for this CPU
+static void (*FindCR)(const uint8_t*, size_t, size_t, std::vector<uint32_t>&) = FindCRScalar;
+static uint8_t (*Xor)(const uint8_t*, size_t) = XorScalar;
+
+static void SelectImplementation(bool allowSimd, const char*& name)
+{
+	name = "scalar";
+#ifdef IBIS_X86
+	if (!allowSimd)
+	{
+		return;
+	}
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		FindCR = FindCRAVX2;
+		Xor = XorAVX2;
+		name = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		FindCR = FindCRSSE2;
+		Xor = XorSSE2;
+		name = "sse2";
+	}
+#endif
+}
+
+// A frame found in step 2: payload starts at begin, the CR is at end, the checksum at end + 1
+struct Frame
+{
+	uint32_t begin;
+	uint32_t end;
+};
+
+// Counters per telegram type
+struct TypeStatistics
+{
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+	uint64_t checksumErrors = 0;
+	uint64_t addressed[16] = {};
+};
+
+// Types are indexed by their leading letter (7 bit) and sub type letter (A..Z or none), so counting is a plain array access
+static const size_t SubTypes = 27;
+static const size_t TypeSlots = 128 * SubTypes;
+
+struct Statistics
+{
+	std::vector<TypeStatistics> types = std::vector<TypeStatistics>(TypeSlots);
+	uint64_t frames = 0;
+	uint64_t checksumErrors = 0;
+	uint64_t garbageBytes = 0;
+	std::vector<uint32_t> errorOffsets;
+
+	void Merge(const Statistics& other)
+	{
+		for (size_t slot = 0; slot < TypeSlots; slot++)
+		{
+			TypeStatistics& type = types[slot];
+			type.frames += other.types[slot].frames;
+			type.bytes += other.types[slot].bytes;
+			type.checksumErrors += other.types[slot].checksumErrors;
+			for (int i = 0; i < 16; i++)
+			{
+				type.addressed[i] += other.types[slot].addressed[i];
+			}
+		}
+		frames += other.frames;
+		checksumErrors += other.checksumErrors;
+		garbageBytes += other.garbageBytes;
+		errorOffsets.insert(errorOffsets.end(), other.errorOffsets.begin(), other.errorOffsets.end());
+	}
+};
+
+// Same type naming as the trace output of Port: the leading letter plus an upper case sub type letter (if any).
+// Empty frames land in slot 0
+static size_t GetTypeSlot(const uint8_t* payload, size_t length)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	size_t slot = (payload[0] & 0x7F) * SubTypes;
+	if (length > 1 && payload[1] >= 'A' && payload[1] <= 'Z')
+	{
+		slot += payload[1] - 'A' + 1;
+	}
+	return slot;
+}
+
+static std::string GetTypeName(size_t slot)
+{
+	if (slot == 0)
+	{
+		return "(empty)";
+	}
+
+	std::string name(1, (char)(slot / SubTypes));
+	if (slot % SubTypes != 0)
+	{
+		name += (char)('A' + slot % SubTypes - 1);
+	}
+	return name;
+}
+
+static void AnalyzeFrames(const uint8_t* data, const Frame* frames, size_t count, bool collectErrors, Statistics& stats)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const Frame& frame = frames[i];
+		const uint8_t* payload = data + frame.begin;
+		size_t length = frame.end - frame.begin;
+
+		// Checksum covers payload and CR, starting at 0x7F
+		uint8_t checksum = 0x7F ^ Xor(payload, length) ^ '\r';
+		bool valid = checksum == data[frame.end + 1];
+
+		TypeStatistics& type = stats.types[GetTypeSlot(payload, length)];
+		type.frames++;
+		type.bytes += length + 2;
+		stats.frames++;
+
+		if (!valid)
+		{
+			type.checksumErrors++;
+			stats.checksumErrors++;
+			if (collectErrors)
+			{
+				stats.errorOffsets.push_back(frame.begin);
+			}
+		}
+		else if (length > 2 && payload[0] == 'a')
+		{
+			// Address is a single VDV hex digit (0..9, :..?)
+			uint8_t address = payload[2] - '0';
+			if (address < 16)
+			{
+				type.addressed[address]++;
+			}
+		}
+	}
+}
+
+static bool AnalyzeFile(const char* path, unsigned threads, bool collectErrors, Statistics& total)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		perror(path);
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		perror(path);
+		close(fd);
+		return false;
+	}
+
+	// Nothing to analyze
+	if (info.st_size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	size_t size = info.st_size;
+	if (size > UINT32_MAX)
+	{
+		fprintf(stderr, "%s: captures larger than 4 GiB need to be split\n", path);
+		close(fd);
+		return false;
+	}
+
+	const uint8_t* data = (const uint8_t*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		perror(path);
+		return false;
+	}
+	madvise((void*)data, size, MADV_SEQUENTIAL);
+
+	// Step 1: find all CR bytes in parallel
+	std::vector<std::vector<uint32_t>> crs(threads);
+	std::vector<std::thread> workers;
+	size_t chunk = (size + threads - 1) / threads;
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			size_t begin = std::min(size, t * chunk);
+			size_t end = std::min(size, begin + chunk);
+			crs[t].reserve((end - begin) / 16);
+			FindCR(data, begin, end, crs[t]);
+		});
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	workers.clear();
+
+	// Step 2: frame boundaries. A frame ends at the first CR at or after its start, the byte after the CR is the
+	// checksum (which may be a CR itself, hence the sequential walk)
+	Statistics garbage;
+	std::vector<Frame> frames;
+	frames.reserve(size / 16);
+	uint32_t start = 0;
+	for (const std::vector<uint32_t>& list : crs)
+	{
+		for (uint32_t cr : list)
+		{
+			if (cr < start || (size_t)cr + 1 >= size)
+			{
+				continue;
+			}
+
+			if (cr - start > MaxFrameLength)
+			{
+				garbage.garbageBytes += cr - start;
+			}
+			else
+			{
+				frames.push_back({ start, cr });
+			}
+			start = cr + 2;
+		}
+	}
+	garbage.garbageBytes += size > start ? size - start : 0;
+	crs.clear();
+
+	// Step 3: validate and count in parallel
+	std::vector<Statistics> partial(threads);
+	size_t frameChunk = (frames.size() + threads - 1) / threads;
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			size_t begin = std::min(frames.size(), t * frameChunk);
+			size_t end = std::min(frames.size(), begin + frameChunk);
+			AnalyzeFrames(data, frames.data() + begin, end - begin, collectErrors, partial[t]);
+		});
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+
+	for (const Statistics& stats : partial)
+	{
+		total.Merge(stats);
+	}
+	total.Merge(garbage);
+
+	munmap((void*)data, size);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	bool collectErrors = false;
+	bool allowSimd = true;
+	std::vector<const char*> files;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+		{
+			threads = std::max(1, atoi(argv[++i]));
+		}
+		else if (strcmp(argv[i], "--errors") == 0)
+		{
+			collectErrors = true;
+		}
+		else if (strcmp(argv[i], "--scalar") == 0)
+		{
+			allowSimd = false;
+		}
+		else
+		{
+			files.push_back(argv[i]);
+		}
+	}
+
+	if (files.empty())
+	{
+		fprintf(stderr, "Usage: %s [-j threads] [--errors] [--scalar] capture.bin...\n", argv[0]);
+		return 2;
+	}
+
+	const char* implementation;
+	SelectImplementation(allowSimd, implementation);
+
+	Statistics total;
+	uint64_t bytes = 0;
+	auto startTime = std::chrono::steady_clock::now();
+	for (const char* file : files)
+	{
+		if (!AnalyzeFile(file, threads, collectErrors, total))
+		{
+			return 1;
+		}
+
+		struct stat info;
+		if (stat(file, &info) == 0)
+		{
+			bytes += info.st_size;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+	printf("%-6s %12s %14s %8s %10s\n", "type", "frames", "bytes", "share", "errors");
+	for (size_t slot = 0; slot < TypeSlots; slot++)
+	{
+		const TypeStatistics& type = total.types[slot];
+		if (type.frames == 0)
+		{
+			continue;
+		}
+
+		printf("%-6s %12llu %14llu %7.2f%% %10llu\n", GetTypeName(slot).c_str(), (unsigned long long)type.frames,
+			(unsigned long long)type.bytes, bytes > 0 ? 100.0 * type.bytes / bytes : 0.0, (unsigned long long)type.checksumErrors);
+
+		for (int address = 0; address < 16; address++)
+		{
+			if (type.addressed[address] > 0)
+			{
+				printf("  address %-2d %9llu\n", address, (unsigned long long)type.addressed[address]);
+			}
+		}
+	}
+
+	printf("\n%llu frames, %llu checksum errors, %llu garbage bytes\n", (unsigned long long)total.frames,
+		(unsigned long long)total.checksumErrors, (unsigned long long)total.garbageBytes);
+	printf("%.1f MB in %.3f s (%.2f GB/s, %s, %u threads)\n", bytes / 1e6, seconds, seconds > 0 ? bytes / seconds / 1e9 : 0.0,
+		implementation, threads);
+
+	if (collectErrors)
+	{
+		std::sort(total.errorOffsets.begin(), total.errorOffsets.end());
+		for (uint32_t offset : total.errorOffsets)
+		{
+			printf("checksum error at offset %u\n", offset);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,611 @@
+﻿// ArduinoIBIS
+// Host tool: converts raw IBIS wagenbus captures to the indexed capture format and queries them
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// The capture format is described in src/ArduinoIBISCapture.h. Queries use the block headers as index: a binary
+// search over the block times finds the start, and blocks whose type/address bitmaps can't match are skipped without
+// reading them, so a query over a multi-GB capture only touches the blocks it needs.
+//
+// Build: g++ -O2 -std=c++17 -I src tools/ibis_capture.cpp src/ArduinoIBISCapture.cpp -o ibis_capture
+// Usage:
+//   ibis_capture import raw.bin out.ibiscap [--start unix-seconds]
+//     Raw captures have no timestamps, they're derived from the byte position at 1200 baud 7E2, counting from --start
+//     (default: modification time of the file minus the duration of the capture)
+//   ibis_capture info capture.ibiscap
+//   ibis_capture query capture.ibiscap [--from time] [--to time] [--type aA] [--address 3]
+//     Times are UNIX seconds, "YYYY-MM-DD HH:MM[:SS]" or "HH:MM[:SS]" on the day the capture starts (local time).
+//     Types are named like in ibis_analyze: leading letter plus upper case sub type letter (if any)
+//   ibis_capture pcapng capture.ibiscap out.pcapng
+//     Converts a capture for Wireshark and other pcapng tools, block by block (out.pcapng can be - for stdout).
+//     Packets are the frames (payload, CR, checksum) with link type USER0 (147), microsecond timestamps, the
+//     direction in the epb_flags and a failed checksum as CRC error (epb_flags bit 24)
+
+#include "ArduinoIBISCapture.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace ArduinoIBIS;
+
+// One byte at 1200 baud with 7E2 framing (start, 7 data, parity, 2 stop bits)
+static const double ByteMicros = 11 * 1000000.0 / 1200;
+
+static bool WriteAll(FILE* file, const void* data, size_t length)
+{
+	return fwrite(data, 1, length, file) == length;
+}
+
+static int Import(const char* rawPath, const char* capturePath, int64_t start)
+{
+	FILE* raw = fopen(rawPath, "rb");
+	if (!raw)
+	{
+		perror(rawPath);
+		return 1;
+	}
+
+	if (start < 0)
+	{
+		struct stat info;
+		fstat(fileno(raw), &info);
+		start = info.st_mtime - (int64_t)(info.st_size * ByteMicros / 1000000);
+	}
+
+	FILE* out = fopen(capturePath, "wb");
+	if (!out)
+	{
+		perror(capturePath);
+		fclose(raw);
+		return 1;
+	}
+
+	CaptureFileHeader fileHeader = {};
+	memcpy(fileHeader.magic, IBIS_CAPTURE_MAGIC, 8);
+	fileHeader.version = IBIS_CAPTURE_VERSION;
+	fileHeader.blockSize = IBIS_CAPTURE_BLOCK_SIZE;
+	std::vector<uint8_t> headerBlock(IBIS_CAPTURE_BLOCK_SIZE);
+	memcpy(headerBlock.data(), &fileHeader, sizeof(fileHeader));
+	WriteAll(out, headerBlock.data(), headerBlock.size());
+
+	static uint8_t buffer[IBIS_CAPTURE_BLOCK_SIZE];
+	CaptureBlock block(buffer);
+	uint64_t blocks = 0;
+	uint64_t records = 0;
+	uint64_t dropped = 0;
+
+	// Frames are collected byte by byte: everything up to the CR, then the checksum byte. Records store the length
+	// in a byte, so longer frames are dropped
+	uint8_t frame[UINT8_MAX];
+	size_t length = 0;
+	bool awaitingChecksum = false;
+	bool discarding = false;
+	uint64_t offset = 0;
+	uint64_t frameStart = 0;
+	bool ok = true;
+
+	int value;
+	while (ok && (value = fgetc(raw)) != EOF)
+	{
+		if (length == 0)
+		{
+			frameStart = offset;
+		}
+		offset++;
+
+		if (length >= sizeof(frame) && !discarding)
+		{
+			// Longer than any telegram (and than a record can hold), drop it
+			dropped++;
+			discarding = true;
+		}
+
+		// The rest of a dropped frame is skipped up to and including the checksum after its CR
+		if (discarding)
+		{
+			if (awaitingChecksum)
+			{
+				discarding = false;
+				awaitingChecksum = false;
+				length = 0;
+			}
+			else
+			{
+				awaitingChecksum = value == '\r';
+			}
+			continue;
+		}
+
+		frame[length++] = (uint8_t)value;
+		if (!awaitingChecksum)
+		{
+			awaitingChecksum = value == '\r';
+			continue;
+		}
+
+		uint8_t checksum = 0x7F;
+		for (size_t i = 0; i + 1 < length; i++)
+		{
+			checksum ^= frame[i];
+		}
+
+		uint8_t flags = CaptureReceived | (checksum == frame[length - 1] ? CaptureChecksumValid : 0);
+		uint64_t time = (uint64_t)start * 1000000 + (uint64_t)(frameStart * ByteMicros);
+		if (!block.Append(time, flags, frame, (uint8_t)length))
+		{
+			ok = WriteAll(out, block.Finish(), IBIS_CAPTURE_BLOCK_SIZE);
+			blocks++;
+			block.Reset();
+			block.Append(time, flags, frame, (uint8_t)length);
+		}
+		records++;
+		length = 0;
+		awaitingChecksum = false;
+	}
+
+	if (ok && !block.IsEmpty())
+	{
+		ok = WriteAll(out, block.Finish(), IBIS_CAPTURE_BLOCK_SIZE);
+		blocks++;
+	}
+
+	fclose(raw);
+	if (fclose(out) != 0 || !ok)
+	{
+		fprintf(stderr, "%s: write failed\n", capturePath);
+		return 1;
+	}
+
+	printf("%llu records in %llu blocks, %llu overlong frames dropped\n", (unsigned long long)records,
+		(unsigned long long)blocks, (unsigned long long)dropped);
+	return 0;
+}
+
+// Read access to a capture file
+struct CaptureFile
+{
+	int fd = -1;
+	uint16_t blockSize = 0;
+	uint32_t dataOffset = 0;
+	uint64_t blockCount = 0;
+
+	bool Open(const char* path)
+	{
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			perror(path);
+			return false;
+		}
+
+		CaptureFileHeader header;
+		struct stat info;
+		if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, IBIS_CAPTURE_MAGIC, 8) != 0 ||
+			header.version == 0 || header.version > IBIS_CAPTURE_VERSION || fstat(fd, &info) != 0)
+		{
+			fprintf(stderr, "%s: not a capture file (version 1 to %d)\n", path, IBIS_CAPTURE_VERSION);
+			return false;
+		}
+
+		// Records are only ever read within IBIS_CAPTURE_BLOCK_SIZE (see ReadCaptureRecord)
+		if (header.blockSize != IBIS_CAPTURE_BLOCK_SIZE)
+		{
+			fprintf(stderr, "%s: block size %u is not supported, only %u\n", path, header.blockSize, IBIS_CAPTURE_BLOCK_SIZE);
+			return false;
+		}
+
+		blockSize = header.blockSize;
+		dataOffset = GetCaptureDataOffset(header);
+		blockCount = (uint64_t)info.st_size > dataOffset ? ((uint64_t)info.st_size - dataOffset) / blockSize : 0;
+		return true;
+	}
+
+	off_t GetOffset(uint64_t index) const { return dataOffset + (off_t)index * blockSize; }
+
+	bool ReadHeader(uint64_t index, CaptureBlockHeader& header) const
+	{
+		return pread(fd, &header, sizeof(header), GetOffset(index)) == sizeof(header) && IsCaptureBlockIntact(header);
+	}
+
+	bool ReadBlock(uint64_t index, std::vector<uint8_t>& block) const
+	{
+		block.resize(blockSize);
+		return pread(fd, block.data(), blockSize, GetOffset(index)) == blockSize;
+	}
+
+	// Index of the first block that has records at or after time (binary search over the block headers)
+	uint64_t FindBlock(uint64_t time) const
+	{
+		uint64_t low = 0;
+		uint64_t high = blockCount;
+		while (low < high)
+		{
+			uint64_t middle = (low + high) / 2;
+			CaptureBlockHeader header;
+			if (ReadHeader(middle, header) && header.lastTime < time)
+			{
+				low = middle + 1;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+		return low;
+	}
+};
+
+static std::string FormatTime(uint64_t time)
+{
+	time_t seconds = time / 1000000;
+	struct tm local;
+	localtime_r(&seconds, &local);
+
+	char text[40];
+	size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &local);
+	snprintf(text + length, sizeof(text) - length, ".%03u", (unsigned)(time % 1000000 / 1000));
+	return text;
+}
+
+// Parses a time argument into microseconds, day is the capture start for times without a date
+static bool ParseTime(const char* text, uint64_t day, uint64_t& time)
+{
+	struct tm local = {};
+	int seconds = 0;
+	if (sscanf(text, "%d-%d-%d %d:%d:%d", &local.tm_year, &local.tm_mon, &local.tm_mday, &local.tm_hour, &local.tm_min, &seconds) >= 5)
+	{
+		local.tm_year -= 1900;
+		local.tm_mon -= 1;
+	}
+	else if (sscanf(text, "%d:%d:%d", &local.tm_hour, &local.tm_min, &seconds) >= 2)
+	{
+		time_t daySeconds = day / 1000000;
+		struct tm start;
+		localtime_r(&daySeconds, &start);
+		local.tm_year = start.tm_year;
+		local.tm_mon = start.tm_mon;
+		local.tm_mday = start.tm_mday;
+	}
+	else
+	{
+		char* end;
+		long long value = strtoll(text, &end, 10);
+		if (*end != '\0')
+		{
+			return false;
+		}
+		time = (uint64_t)value * 1000000;
+		return true;
+	}
+
+	local.tm_sec = seconds;
+	local.tm_isdst = -1;
+	time = (uint64_t)mktime(&local) * 1000000;
+	return true;
+}
+
+static bool MatchesType(const CaptureRecord& record, const std::string& type)
+{
+	if (record.length == 0 || record.frame[0] != (uint8_t)type[0])
+	{
+		return false;
+	}
+
+	bool hasSubType = record.length > 1 && record.frame[1] >= 'A' && record.frame[1] <= 'Z';
+	return type.size() == 1 ? !hasSubType : hasSubType && record.frame[1] == (uint8_t)type[1];
+}
+
+static int Info(const char* path)
+{
+	CaptureFile file;
+	if (!file.Open(path))
+	{
+		return 1;
+	}
+
+	uint64_t records = 0;
+	CaptureBlockHeader first = {};
+	CaptureBlockHeader last = {};
+	for (uint64_t i = 0; i < file.blockCount; i++)
+	{
+		CaptureBlockHeader header;
+		if (!file.ReadHeader(i, header))
+		{
+			fprintf(stderr, "block %llu is damaged\n", (unsigned long long)i);
+			continue;
+		}
+
+		if (records == 0)
+		{
+			first = header;
+		}
+		last = header;
+		records += header.recordCount;
+	}
+
+	printf("%llu blocks of %u bytes, %llu records\n", (unsigned long long)file.blockCount, file.blockSize, (unsigned long long)records);
+	if (records > 0)
+	{
+		printf("from %s to %s\n", FormatTime(first.firstTime).c_str(), FormatTime(last.lastTime).c_str());
+	}
+	return 0;
+}
+
+static int Query(const char* path, int argc, char** argv)
+{
+	CaptureFile file;
+	if (!file.Open(path))
+	{
+		return 1;
+	}
+
+	CaptureBlockHeader firstHeader = {};
+	file.ReadHeader(0, firstHeader);
+
+	uint64_t from = 0;
+	uint64_t to = UINT64_MAX;
+	std::string type;
+	int8_t address = -1;
+	for (int i = 0; i + 1 < argc; i += 2)
+	{
+		bool valid = true;
+		if (strcmp(argv[i], "--from") == 0)
+		{
+			valid = ParseTime(argv[i + 1], firstHeader.firstTime, from);
+		}
+		else if (strcmp(argv[i], "--to") == 0)
+		{
+			valid = ParseTime(argv[i + 1], firstHeader.firstTime, to);
+		}
+		else if (strcmp(argv[i], "--type") == 0)
+		{
+			type = argv[i + 1];
+			valid = type.size() == 1 || type.size() == 2;
+		}
+		else if (strcmp(argv[i], "--address") == 0)
+		{
+			address = (int8_t)atoi(argv[i + 1]);
+			valid = address >= 0 && address < 16;
+		}
+		else
+		{
+			valid = false;
+		}
+
+		if (!valid)
+		{
+			fprintf(stderr, "Invalid argument %s %s\n", argv[i], argv[i + 1]);
+			return 2;
+		}
+	}
+
+	uint64_t matches = 0;
+	uint64_t blocksRead = 0;
+	uint64_t damaged = 0;
+	std::vector<uint8_t> block;
+	for (uint64_t i = file.FindBlock(from); i < file.blockCount; i++)
+	{
+		CaptureBlockHeader header;
+		if (!file.ReadHeader(i, header))
+		{
+			damaged++;
+			continue;
+		}
+		if (header.firstTime > to)
+		{
+			break;
+		}
+		if ((!type.empty() && !CaptureBlockMayContain(header, type[0], address)) ||
+			(type.empty() && address >= 0 && !(header.addresses & (1 << address))))
+		{
+			continue;
+		}
+
+		if (!file.ReadBlock(i, block))
+		{
+			break;
+		}
+		blocksRead++;
+
+		uint16_t offset = 0;
+		CaptureRecord record;
+		while (ReadCaptureRecord(block.data(), header, offset, record))
+		{
+			if (record.time < from || record.time > to || (!type.empty() && !MatchesType(record, type)) ||
+				(address >= 0 && GetCaptureAddress(record.frame, record.length) != address))
+			{
+				continue;
+			}
+
+			// Payload without CR and checksum
+			uint8_t payloadLength = record.length >= 2 ? record.length - 2 : record.length;
+			printf("%s %s %s %.*s\n", FormatTime(record.time).c_str(), record.flags & CaptureReceived ? "RX" : "TX",
+				record.flags & CaptureChecksumValid ? "ok " : "bad", payloadLength, (const char*)record.frame);
+			matches++;
+		}
+	}
+
+	fprintf(stderr, "%llu matches, read %llu of %llu blocks, %llu damaged blocks skipped\n", (unsigned long long)matches,
+		(unsigned long long)blocksRead, (unsigned long long)file.blockCount, (unsigned long long)damaged);
+	return 0;
+}
+
+// pcapng block types and options, see https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-02.html
+static const uint32_t PcapSectionHeader = 0x0A0D0D0A;
+static const uint32_t PcapInterfaceDescription = 0x00000001;
+static const uint32_t PcapEnhancedPacket = 0x00000006;
+static const uint16_t PcapLinkTypeUser0 = 147;
+static const uint16_t PcapOptionEnd = 0;
+static const uint16_t PcapOptionInterfaceName = 2;
+static const uint16_t PcapOptionTimestampResolution = 9;
+static const uint16_t PcapOptionFlags = 2;
+static const uint32_t PcapFlagInbound = 0x00000001;
+static const uint32_t PcapFlagOutbound = 0x00000002;
+static const uint32_t PcapFlagCRCError = 0x01000000;
+
+// Builds one pcapng block in memory: body and options are appended, Finish() fills in both length fields
+struct PcapBlock
+{
+	std::vector<uint8_t> data;
+
+	explicit PcapBlock(uint32_t type)
+	{
+		Append(&type, 4);
+		Append32(0);
+	}
+
+	void Append(const void* bytes, size_t length)
+	{
+		data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + length);
+	}
+
+	void Append16(uint16_t value) { Append(&value, 2); }
+	void Append32(uint32_t value) { Append(&value, 4); }
+
+	void Pad()
+	{
+		data.resize((data.size() + 3) & ~(size_t)3, 0);
+	}
+
+	void AppendOption(uint16_t code, const void* value, uint16_t length)
+	{
+		Append16(code);
+		Append16(length);
+		Append(value, length);
+		Pad();
+	}
+
+	bool Finish(FILE* file)
+	{
+		uint32_t length = (uint32_t)data.size() + 4;
+		memcpy(&data[4], &length, 4);
+		Append32(length);
+		return WriteAll(file, data.data(), data.size());
+	}
+};
+
+static int ExportPcapng(const char* path, const char* outPath)
+{
+	CaptureFile file;
+	if (!file.Open(path))
+	{
+		return 1;
+	}
+
+	bool toStdout = strcmp(outPath, "-") == 0;
+	FILE* out = toStdout ? stdout : fopen(outPath, "wb");
+	if (!out)
+	{
+		perror(outPath);
+		return 1;
+	}
+
+	PcapBlock section(PcapSectionHeader);
+	section.Append32(0x1A2B3C4D);
+	section.Append16(1);
+	section.Append16(0);
+	int64_t sectionLength = -1;
+	section.Append(&sectionLength, 8);
+	bool ok = section.Finish(out);
+
+	PcapBlock interface(PcapInterfaceDescription);
+	interface.Append16(PcapLinkTypeUser0);
+	interface.Append16(0);
+	interface.Append32(0);
+	interface.AppendOption(PcapOptionInterfaceName, "ibis", 4);
+	uint8_t microseconds = 6;
+	interface.AppendOption(PcapOptionTimestampResolution, &microseconds, 1);
+	interface.Append32(PcapOptionEnd);
+	ok = ok && interface.Finish(out);
+
+	// Only one capture block is held in memory at a time
+	uint64_t packets = 0;
+	std::vector<uint8_t> block;
+	for (uint64_t i = 0; ok && i < file.blockCount; i++)
+	{
+		CaptureBlockHeader header;
+		if (!file.ReadHeader(i, header))
+		{
+			fprintf(stderr, "block %llu is damaged, skipped\n", (unsigned long long)i);
+			continue;
+		}
+		if (!file.ReadBlock(i, block))
+		{
+			break;
+		}
+
+		uint16_t offset = 0;
+		CaptureRecord record;
+		while (ok && ReadCaptureRecord(block.data(), header, offset, record))
+		{
+			PcapBlock packet(PcapEnhancedPacket);
+			packet.Append32(0);
+			packet.Append32((uint32_t)(record.time >> 32));
+			packet.Append32((uint32_t)record.time);
+			packet.Append32(record.length);
+			packet.Append32(record.length);
+			packet.Append(record.frame, record.length);
+			packet.Pad();
+
+			uint32_t flags = (record.flags & CaptureReceived) ? PcapFlagInbound : PcapFlagOutbound;
+			if (!(record.flags & CaptureChecksumValid))
+			{
+				flags |= PcapFlagCRCError;
+			}
+			packet.AppendOption(PcapOptionFlags, &flags, 4);
+			packet.Append32(PcapOptionEnd);
+
+			ok = packet.Finish(out);
+			packets++;
+		}
+	}
+
+	if ((toStdout ? fflush(out) : fclose(out)) != 0 || !ok)
+	{
+		fprintf(stderr, "%s: write failed\n", outPath);
+		return 1;
+	}
+
+	fprintf(stderr, "%llu packets\n", (unsigned long long)packets);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 4 && strcmp(argv[1], "import") == 0)
+	{
+		int64_t start = -1;
+		if (argc >= 6 && strcmp(argv[4], "--start") == 0)
+		{
+			start = strtoll(argv[5], nullptr, 10);
+		}
+		return Import(argv[2], argv[3], start);
+	}
+	if (argc == 3 && strcmp(argv[1], "info") == 0)
+	{
+		return Info(argv[2]);
+	}
+	if (argc >= 3 && strcmp(argv[1], "query") == 0)
+	{
+		return Query(argv[2], argc - 3, argv + 3);
+	}
+	if (argc == 4 && strcmp(argv[1], "pcapng") == 0)
+	{
+		return ExportPcapng(argv[2], argv[3]);
+	}
+
+	fprintf(stderr, "Usage: %s import raw.bin out.ibiscap [--start unix-seconds]\n"
+		"       %s info capture.ibiscap\n"
+		"       %s query capture.ibiscap [--from time] [--to time] [--type aA] [--address 3]\n"
+		"       %s pcapng capture.ibiscap out.pcapng\n", argv[0], argv[0], argv[0], argv[0]);
+	return 2;
+}
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+# ArduinoIBIS
+# Compiler for the binary config read by ArduinoIBIS::Config (see src/ArduinoIBISConfig.h)
+
+# Copyright (c) 2025 Jonathan Verbeek
+# Licensed under the MIT License, see LICENSE
+
+# Input (JSON, or YAML if PyYAML is installed):
+#   {
+#     "devices": [
+#       { "address": 1, "width": 120, "font": "Fixed5x7" },
+#       { "address": 3, "charset": "PlainASCII" }
+#     ],
+#     "timers": [
+#       { "interval_ms": 60000, "payload": "u1234" },
+#       { "interval_ms": 10000, "payload": "zA1Hauptbahnhof     ", "producer": 1 }
+#     ]
+#   }
+#
+# Payloads are the telegram without CR and checksum, in the VDV 300 character set (umlauts as {|}~[\]).
+# Layout (version 1, little endian, tables aligned to 4 bytes):
+#   header  u32 magic "IBCF", u16 version, u16 size, u8 device count, u8 timer count, u16 devices offset,
+#           u16 timers offset, u16 reserved
+#   device  u8 address, u8 charset, u8 font, u8 reserved, u16 width, u16 reserved
+#   timer   u32 interval in ms, u16 payload offset (from the start of the record), u8 payload length, u8 producer
+#   payloads
+#
+# Usage: ibis_config.py config.json out.ibiscfg     writes the binary config
+#        ibis_config.py config.yaml out.h --header  writes a C header with the config as a PROGMEM array
+#        ibis_config.py --dump config.ibiscfg       prints a binary config
+
+import json
+import struct
+import sys
+
+MAGIC = 0x46434249
+VERSION = 1
+HEADER = struct.Struct("<IHHBBHHH")
+DEVICE = struct.Struct("<BBBBHH")
+TIMER = struct.Struct("<IHBB")
+
+CHARSETS = {"default": 0, "PlainASCII": 1}
+FONTS = {"none": 0, "Fixed5x7": 1}
+
+# Defaults of the library build (IBIS_MAX_DEVICES, IBIS_MAX_TIMERS, IBIS_MAX_PRODUCERS, IBIS_TELEGRAM_MAX_LENGTH)
+MAX_DEVICES = 16
+MAX_TIMERS = 8
+MAX_PRODUCERS = 4
+MAX_PAYLOAD = 128 - 2
+
+
+def load(path):
+    with open(path, encoding="utf-8") as f:
+        if path.endswith((".yaml", ".yml")):
+            try:
+                import yaml
+            except ImportError:
+                sys.exit("Reading YAML needs PyYAML (pip install pyyaml)")
+            return yaml.safe_load(f)
+        return json.load(f)
+
+
+def lookup(table, value, what):
+    if value not in table:
+        raise ValueError("unknown %s %r (one of %s)" % (what, value, ", ".join(table)))
+    return table[value]
+
+
+def compile_config(config):
+    devices = config.get("devices", [])
+    timers = config.get("timers", [])
+    if len(devices) > MAX_DEVICES or len(timers) > MAX_TIMERS:
+        raise ValueError("at most %d devices and %d timers" % (MAX_DEVICES, MAX_TIMERS))
+
+    devices_offset = HEADER.size
+    timers_offset = devices_offset + len(devices) * DEVICE.size
+    payloads_offset = timers_offset + len(timers) * TIMER.size
+
+    out = bytearray()
+    seen = set()
+    for device in devices:
+        address = int(device["address"])
+        if not 0 <= address < MAX_DEVICES or address in seen:
+            raise ValueError("bad or duplicate device address %r" % address)
+        seen.add(address)
+        charset = lookup(CHARSETS, device.get("charset", "default"), "charset")
+        font = lookup(FONTS, device.get("font", "none"), "font")
+        width = int(device.get("width", 0))
+        if not 0 <= width <= 0xFFFF:
+            raise ValueError("bad width %r for device %d" % (width, address))
+        out += DEVICE.pack(address, charset, font, 0, width, 0)
+
+    payloads = bytearray()
+    for index, timer in enumerate(timers):
+        payload = timer["payload"].encode("ascii")
+        if not payload or len(payload) > MAX_PAYLOAD or any(b < 0x20 and b not in (0x03, 0x04, 0x05, 0x0A) or b > 0x7F for b in payload):
+            raise ValueError("bad payload %r" % timer["payload"])
+        interval = int(timer["interval_ms"])
+        producer = int(timer.get("producer", 0))
+        if not 0 < interval <= 0xFFFFFFFF or not 0 <= producer < MAX_PRODUCERS:
+            raise ValueError("bad interval or producer in timer %d" % index)
+        record_offset = timers_offset + index * TIMER.size
+        out += TIMER.pack(interval, payloads_offset + len(payloads) - record_offset, len(payload), producer)
+        payloads += payload
+
+    size = payloads_offset + len(payloads)
+    size += -size % 4
+    if size > 0xFFFF:
+        raise ValueError("config is too large")
+
+    header = HEADER.pack(MAGIC, VERSION, size, len(devices), len(timers), devices_offset, timers_offset, 0)
+    data = header + out + payloads
+    return bytes(data + bytes(size - len(data)))
+
+
+def write_header(data, path):
+    lines = ["// Generated by tools/ibis_config.py, do not edit", "#pragma once", "#include <Arduino.h>", "",
+             "alignas(4) static const uint8_t IBISConfig[%d] PROGMEM =" % len(data), "{"]
+    for i in range(0, len(data), 16):
+        lines.append("\t" + ", ".join("0x%02X" % b for b in data[i:i + 16]) + ",")
+    lines += ["};", ""]
+    with open(path, "w") as f:
+        f.write("\n".join(lines))
+
+
+def dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    magic, version, size, device_count, timer_count, devices_offset, timers_offset, _ = HEADER.unpack_from(data)
+    if magic != MAGIC:
+        sys.exit("not a config")
+    print("version %d, %d bytes" % (version, size))
+    charsets = {v: k for k, v in CHARSETS.items()}
+    fonts = {v: k for k, v in FONTS.items()}
+    for i in range(device_count):
+        address, charset, font, _, width, _ = DEVICE.unpack_from(data, devices_offset + i * DEVICE.size)
+        print("device %d: charset %s, font %s, width %d" % (address, charsets.get(charset, charset), fonts.get(font, font), width))
+    for i in range(timer_count):
+        offset = timers_offset + i * TIMER.size
+        interval, payload_offset, length, producer = TIMER.unpack_from(data, offset)
+        payload = data[offset + payload_offset:offset + payload_offset + length].decode("ascii")
+        print("timer every %d ms, producer %d: %r" % (interval, producer, payload))
+
+
+def main():
+    args = sys.argv[1:]
+    if len(args) == 2 and args[0] == "--dump":
+        dump(args[1])
+        return
+    if len(args) not in (2, 3) or (len(args) == 3 and args[2] != "--header"):
+        sys.exit("Usage: ibis_config.py config.json|yaml out [--header]\n       ibis_config.py --dump config.ibiscfg")
+
+    try:
+        data = compile_config(load(args[0]))
+    except (KeyError, ValueError) as e:
+        sys.exit("%s: %s" % (args[0], e))
+
+    if len(args) == 3:
+        write_header(data, args[1])
+    else:
+        with open(args[1], "wb") as f:
+            f.write(data)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,455 @@
+// ArduinoIBIS
+// Host tool: sends telegrams from local clients to an IBIS wagenbus through a serial adapter (Linux)
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// Clients connect to a Unix socket and submit telegrams in one of two ways:
+//  - Stream: records (see ibis_ring.h) are written to the socket. Simple, but costs a syscall and a copy per telegram
+//  - Ring: the client passes a shared-memory ring with its eventfds (IbisRing::Producer::Attach) and writes records
+//    into it. The daemon writes them to the bus straight from the shared memory, and is only woken up by the eventfd
+//    when it ran out of work. This is meant for high-rate producers like simulators
+//
+// Clients are served round robin, one telegram at a time, so a busy client can't hold back the others. Records of
+// kind Payload get CR and checksum added, Frame records are sent as they are.
+//
+// The bus is configured with termios for 1200 baud 7E2. Any other file (e.g. /dev/null or - for stdout) takes the
+// plain bytes, which is handy for testing and for measuring the submission paths without the bus as the bottleneck.
+// Ctrl+C prints the statistics per client.
+//
+// Build: g++ -O2 -std=c++17 tools/ibis_daemon.cpp -o ibis_daemon
+// Usage: ibis_daemon [--socket /tmp/ibis.sock] /dev/ttyUSB0 | file | -
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <termios.h>
+
+#include "ibis_ring.h"
+
+struct Client
+{
+	int socketFd = -1;
+	std::unique_ptr<IbisRing::Consumer> ring;
+
+	// Records received on the socket (stream path)
+	std::vector<uint8_t> stream;
+	size_t streamOffset = 0;
+
+	// The client hung up, it's removed once its records are sent
+	bool closed = false;
+
+	// Its socket isn't read until the stream buffer drained
+	bool paused = false;
+
+	uint64_t frames = 0;
+	uint64_t bytes = 0;
+};
+
+// Stream records buffered per client before its socket isn't read anymore
+static const size_t MaxStreamBuffer = 64 * 1024;
+
+static volatile sig_atomic_t Stop = 0;
+
+static void HandleSignal(int)
+{
+	Stop = 1;
+}
+
+// Configures a serial device for sending to the bus: 1200 baud, 7 data bits, even parity, 2 stop bits, raw mode
+static bool ConfigureSerial(int fd)
+{
+	struct termios options;
+	if (tcgetattr(fd, &options) != 0)
+	{
+		return false;
+	}
+
+	cfmakeraw(&options);
+	cfsetispeed(&options, B1200);
+	cfsetospeed(&options, B1200);
+	options.c_cflag &= ~(CSIZE | PARODD | CRTSCTS);
+	options.c_cflag |= CS7 | PARENB | CSTOPB | CREAD | CLOCAL;
+	options.c_iflag &= ~(IXON | IXOFF);
+	return tcsetattr(fd, TCSANOW, &options) == 0;
+}
+
+static bool WriteAll(int fd, iovec* io, int count)
+{
+	while (count > 0)
+	{
+		ssize_t written = writev(fd, io, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+
+		for (; count > 0 && (size_t)written >= io->iov_len; io++, count--)
+		{
+			written -= io->iov_len;
+		}
+		if (count > 0)
+		{
+			io->iov_base = (uint8_t*)io->iov_base + written;
+			io->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+// Telegrams collected from the clients and written to the bus with a single writev(). Ring records are written from
+// the shared memory, so their ring space is only released after the batch is written
+struct Batch
+{
+	static const int MaxRecords = 64;
+
+	iovec io[MaxRecords * 2];
+	uint8_t trailers[MaxRecords][2];
+	int ioCount = 0;
+	int records = 0;
+
+	// Adds a record, with CR and checksum for payloads
+	void Add(const IbisRing::Record& record)
+	{
+		io[ioCount++] = { (void*)record.data, record.length };
+		if (record.kind == IbisRing::Payload)
+		{
+			uint8_t* trailer = trailers[records];
+			trailer[0] = '\r';
+			trailer[1] = 0x7F ^ '\r';
+			for (uint16_t i = 0; i < record.length; i++)
+			{
+				trailer[1] ^= record.data[i];
+			}
+			io[ioCount++] = { trailer, 2 };
+		}
+		records++;
+	}
+
+	bool IsFull() const { return records == MaxRecords; }
+};
+
+// Gets the next record of a client, from the socket first and then from its ring. Returns false if it has none, and
+// sets broken if it sent garbage
+static bool NextRecord(Client& client, IbisRing::Record& record, bool& broken)
+{
+	broken = false;
+	size_t available = client.stream.size() - client.streamOffset;
+	if (available >= sizeof(IbisRing::RecordHeader))
+	{
+		IbisRing::RecordHeader header;
+		memcpy(&header, client.stream.data() + client.streamOffset, sizeof(header));
+		if (header.length > IbisRing::MaxRecordLength || (header.kind != IbisRing::Frame && header.kind != IbisRing::Payload))
+		{
+			broken = true;
+			return false;
+		}
+		if (available >= IbisRing::RecordSize(header.length))
+		{
+			record.kind = (IbisRing::RecordKind)header.kind;
+			record.length = header.length;
+			record.data = client.stream.data() + client.streamOffset + sizeof(header);
+			client.streamOffset += IbisRing::RecordSize(header.length);
+			return true;
+		}
+	}
+
+	return client.ring != nullptr && client.ring->Next(record, broken);
+}
+
+// Reads from a client's socket: stream records, a ring, or the end of the connection
+static bool ReadClient(Client& client)
+{
+	uint8_t buffer[4096];
+	int fds[3];
+	char control[CMSG_SPACE(sizeof(fds))];
+	iovec io = { buffer, sizeof(buffer) };
+	msghdr message = {};
+	message.msg_iov = &io;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	ssize_t length = recvmsg(client.socketFd, &message, MSG_CMSG_CLOEXEC);
+	if (length <= 0)
+	{
+		return length < 0 && errno == EAGAIN;
+	}
+
+	cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+	{
+		size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(header), count * sizeof(int));
+		if (count != 3 || length != 1 || buffer[0] != 'R' || client.ring != nullptr)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				close(fds[i]);
+			}
+			return false;
+		}
+
+		client.ring.reset(new IbisRing::Consumer());
+		return client.ring->Attach(fds[0], fds[1], fds[2]);
+	}
+
+	// Drop what was sent already, everything in the buffer was written to the bus by now
+	client.stream.erase(client.stream.begin(), client.stream.begin() + client.streamOffset);
+	client.streamOffset = 0;
+	client.stream.insert(client.stream.end(), buffer, buffer + length);
+	return true;
+}
+
+static void PrintClient(uint64_t id, const Client& client)
+{
+	fprintf(stderr, "Client %llu: %llu telegrams, %llu bytes (%s)\n", (unsigned long long)id, (unsigned long long)client.frames,
+		(unsigned long long)client.bytes, client.ring != nullptr ? "ring" : "stream");
+}
+
+// Writes the clients' telegrams round robin, one per client and round, in batches. Returns after a few batches so new
+// connections are still accepted under load, and returns whether there's more to send. Sets failed if the bus
+// couldn't be written
+static bool Drain(std::map<uint64_t, Client>& clients, int out, bool& failed)
+{
+	failed = false;
+	for (int batches = 0; batches < 16; batches++)
+	{
+		Batch batch;
+		bool more = true;
+		while (more && !batch.IsFull())
+		{
+			more = false;
+			for (auto it = clients.begin(); it != clients.end() && !batch.IsFull();)
+			{
+				Client& client = it->second;
+				IbisRing::Record record;
+				bool broken;
+				if (NextRecord(client, record, broken))
+				{
+					batch.Add(record);
+					client.frames++;
+					client.bytes += record.length;
+					more = true;
+					++it;
+					continue;
+				}
+
+				if (broken)
+				{
+					fprintf(stderr, "Client %llu sent a broken record, disconnecting\n", (unsigned long long)it->first);
+					client.closed = true;
+					client.stream.clear();
+					client.streamOffset = 0;
+				}
+
+				// Records of this client may still be in the batch, so it's only removed while there's none
+				if (client.closed && batch.records == 0)
+				{
+					PrintClient(it->first, client);
+					close(client.socketFd);
+					it = clients.erase(it);
+					continue;
+				}
+				++it;
+			}
+		}
+
+		if (batch.records == 0)
+		{
+			return false;
+		}
+		if (!WriteAll(out, batch.io, batch.ioCount))
+		{
+			failed = true;
+			return false;
+		}
+
+		for (auto& entry : clients)
+		{
+			if (entry.second.ring != nullptr)
+			{
+				entry.second.ring->Release();
+			}
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	const char* socketPath = "/tmp/ibis.sock";
+	const char* outputPath = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else
+		{
+			outputPath = argv[i];
+		}
+	}
+	if (outputPath == nullptr)
+	{
+		fprintf(stderr, "Usage: %s [--socket /tmp/ibis.sock] /dev/ttyUSB0 | file | -\n", argv[0]);
+		return 2;
+	}
+
+	int out = strcmp(outputPath, "-") == 0 ? STDOUT_FILENO : open(outputPath, O_WRONLY | O_NOCTTY | O_CREAT | O_APPEND, 0644);
+	if (out < 0)
+	{
+		perror(outputPath);
+		return 1;
+	}
+	if (isatty(out) && !ConfigureSerial(out))
+	{
+		perror("termios");
+		return 1;
+	}
+
+	int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	unlink(socketPath);
+	if (bind(server, (sockaddr*)&address, sizeof(address)) < 0 || listen(server, 16) < 0)
+	{
+		perror(socketPath);
+		return 1;
+	}
+
+	struct sigaction action = {};
+	action.sa_handler = HandleSignal;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Events carry the client id, shifted left by one; the lowest bit is set for its ring's eventfd
+	int poller = epoll_create1(EPOLL_CLOEXEC);
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.u64 = 0;
+	epoll_ctl(poller, EPOLL_CTL_ADD, server, &event);
+
+	std::map<uint64_t, Client> clients;
+	uint64_t nextId = 1;
+	uint64_t wakeups = 0;
+	bool pending = false;
+
+	while (!Stop)
+	{
+		// Before sleeping, every ring has to be told to signal its eventfd. If one got records meanwhile, don't sleep
+		int timeout = pending ? 0 : -1;
+		for (auto it = clients.begin(); it != clients.end() && timeout != 0; ++it)
+		{
+			if (it->second.ring != nullptr && !it->second.ring->PrepareWait())
+			{
+				timeout = 0;
+			}
+		}
+
+		epoll_event events[32];
+		int count = epoll_wait(poller, events, 32, timeout);
+		if (count < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			return 1;
+		}
+		if (timeout != 0)
+		{
+			wakeups++;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			uint64_t tag = events[i].data.u64;
+			if (tag == 0)
+			{
+				int fd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+				if (fd >= 0)
+				{
+					uint64_t id = nextId++;
+					clients[id].socketFd = fd;
+					event.data.u64 = id << 1;
+					epoll_ctl(poller, EPOLL_CTL_ADD, fd, &event);
+				}
+				continue;
+			}
+
+			auto it = clients.find(tag >> 1);
+			if (it == clients.end() || (tag & 1) != 0 || it->second.closed)
+			{
+				continue;
+			}
+
+			Client& client = it->second;
+			bool hadRing = client.ring != nullptr;
+			if (!ReadClient(client))
+			{
+				client.closed = true;
+				epoll_ctl(poller, EPOLL_CTL_DEL, client.socketFd, nullptr);
+			}
+			else if (!hadRing && client.ring != nullptr)
+			{
+				event.data.u64 = (it->first << 1) | 1;
+				epoll_ctl(poller, EPOLL_CTL_ADD, client.ring->GetDataFd(), &event);
+			}
+		}
+
+		for (auto& entry : clients)
+		{
+			if (entry.second.ring != nullptr)
+			{
+				entry.second.ring->FinishWait();
+			}
+		}
+
+		bool failed;
+		pending = Drain(clients, out, failed);
+		if (failed)
+		{
+			perror(outputPath);
+			return 1;
+		}
+
+		// The stream path has no back pressure of its own: stop reading from clients which are far ahead of the bus,
+		// so the socket buffer fills up and blocks them
+		for (auto& entry : clients)
+		{
+			Client& client = entry.second;
+			size_t buffered = client.stream.size() - client.streamOffset;
+			bool pause = !client.paused && buffered > MaxStreamBuffer;
+			bool resume = client.paused && buffered < MaxStreamBuffer / 2;
+			if (!client.closed && (pause || resume))
+			{
+				client.paused = pause;
+				event.events = pause ? 0u : (uint32_t)EPOLLIN;
+				event.data.u64 = entry.first << 1;
+				epoll_ctl(poller, EPOLL_CTL_MOD, client.socketFd, &event);
+				event.events = EPOLLIN;
+			}
+		}
+	}
+
+	for (auto& entry : clients)
+	{
+		PrintClient(entry.first, entry.second);
+	}
+	fprintf(stderr, "%llu wake-ups\n", (unsigned long long)wakeups);
+	unlink(socketPath);
+	return 0;
+}
@@ -0,0 +1,372 @@
+// ArduinoIBIS
+// Host tool: passively monitors an IBIS wagenbus and shows a live dashboard of the load per telegram type and address
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// Reads the bus through a serial adapter (RX only, configured with termios for 1200 baud 7E2) and keeps rolling
+// statistics over the last --window seconds. Every frame updates the counters of the current one second bucket and
+// the window totals; when a bucket leaves the window only the slots it touched are subtracted, so the cost per frame
+// is constant no matter how long the window is.
+//
+// Utilisation is the wire time of the bytes seen in the window (11 bits per byte at 1200 baud) relative to the window
+// length. What's left of 100% is the budget for our own traffic.
+//
+// Instead of a serial device, a raw capture file (or - for stdin) can be given. Time then advances with the byte
+// position at 1200 baud and the dashboard is printed once at the end.
+//
+// Build: g++ -O2 -std=c++17 tools/ibis_monitor.cpp -o ibis_monitor
+// Usage: ibis_monitor [--window seconds] /dev/ttyUSB0 | capture.bin | -
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+// One byte at 1200 baud with 7E2 framing (start, 7 data, parity, 2 stop bits)
+static const double ByteMicros = 11 * 1000000.0 / 1200;
+static const double BytesPerSecond = 1200.0 / 11;
+
+// Types are indexed by their leading letter (7 bit) and sub type letter (A..Z or none), like in ibis_analyze
+static const size_t SubTypes = 27;
+static const size_t TypeSlots = 128 * SubTypes;
+
+// Frames longer than this can't be IBIS telegrams, they're counted as garbage
+static const size_t MaxFrameLength = 256;
+
+static size_t GetTypeSlot(const uint8_t* payload, size_t length)
+{
+	if (length == 0)
+	{
+		return 0;
+	}
+
+	size_t slot = (payload[0] & 0x7F) * SubTypes;
+	if (length > 1 && payload[1] >= 'A' && payload[1] <= 'Z')
+	{
+		slot += payload[1] - 'A' + 1;
+	}
+	return slot;
+}
+
+static std::string GetTypeName(size_t slot)
+{
+	if (slot == 0)
+	{
+		return "(empty)";
+	}
+
+	std::string name(1, (char)(slot / SubTypes));
+	if (slot % SubTypes != 0)
+	{
+		name += (char)('A' + slot % SubTypes - 1);
+	}
+	return name;
+}
+
+struct Counter
+{
+	uint32_t frames = 0;
+	uint32_t bytes = 0;
+	uint32_t errors = 0;
+};
+
+// Counters of one second
+struct Bucket
+{
+	std::vector<Counter> types = std::vector<Counter>(TypeSlots);
+	Counter addresses[16];
+	std::vector<uint16_t> touched;
+	uint32_t garbageBytes = 0;
+};
+
+class Monitor
+{
+public:
+	explicit Monitor(unsigned window)
+		: _buckets(window)
+		, _totals(TypeSlots)
+	{
+	}
+
+	// Advances the window to the given second, expiring the buckets that fall out of it
+	void Advance(uint64_t second)
+	{
+		if (!_started)
+		{
+			_current = second;
+			_started = true;
+			return;
+		}
+
+		while (_current < second)
+		{
+			_current++;
+			Expire(_buckets[_current % _buckets.size()]);
+			_elapsed = std::min<uint64_t>(_elapsed + 1, _buckets.size() - 1);
+		}
+	}
+
+	void AddFrame(const uint8_t* frame, size_t length, bool valid)
+	{
+		Bucket& bucket = _buckets[_current % _buckets.size()];
+
+		// Without CR and checksum
+		size_t payloadLength = length >= 2 ? length - 2 : 0;
+		uint16_t slot = (uint16_t)GetTypeSlot(frame, payloadLength);
+		Counter& counter = bucket.types[slot];
+		if (counter.frames == 0)
+		{
+			bucket.touched.push_back(slot);
+		}
+		Add(counter, _totals[slot], length, valid);
+
+		// Addressed telegrams: a, sub type letter, address as VDV hex digit (0..9, :..?)
+		if (valid && payloadLength >= 3 && frame[0] == 'a' && frame[2] >= '0' && frame[2] <= '?')
+		{
+			uint8_t address = frame[2] - '0';
+			Add(bucket.addresses[address], _addressTotals[address], length, valid);
+		}
+	}
+
+	void AddGarbage(size_t bytes)
+	{
+		_buckets[_current % _buckets.size()].garbageBytes += bytes;
+		_garbageBytes += bytes;
+	}
+
+	void Print(FILE* out) const
+	{
+		// The current second is part of the window, even though it's not over yet
+		double seconds = (double)_elapsed + 1;
+
+		uint64_t frames = 0;
+		uint64_t bytes = _garbageBytes;
+		std::vector<size_t> slots;
+		for (size_t slot = 0; slot < TypeSlots; slot++)
+		{
+			if (_totals[slot].frames > 0)
+			{
+				slots.push_back(slot);
+				frames += _totals[slot].frames;
+				bytes += _totals[slot].bytes;
+			}
+		}
+		std::sort(slots.begin(), slots.end(), [&](size_t a, size_t b) { return _totals[a].bytes > _totals[b].bytes; });
+
+		double utilisation = 100.0 * bytes / (BytesPerSecond * seconds);
+		fprintf(out, "Last %.0f s: %llu frames (%.1f/s), %llu bytes, utilisation %.1f%%, %.0f bytes/s left\n\n", seconds,
+			(unsigned long long)frames, frames / seconds, (unsigned long long)bytes, utilisation,
+			std::max(0.0, BytesPerSecond - bytes / seconds));
+
+		fprintf(out, "%-8s %10s %9s %10s %8s %8s\n", "type", "frames", "frames/s", "bytes", "share", "errors");
+		for (size_t slot : slots)
+		{
+			const Counter& counter = _totals[slot];
+			fprintf(out, "%-8s %10u %9.2f %10u %7.1f%% %8u\n", GetTypeName(slot).c_str(), counter.frames, counter.frames / seconds,
+				counter.bytes, bytes > 0 ? 100.0 * counter.bytes / bytes : 0.0, counter.errors);
+		}
+		if (_garbageBytes > 0)
+		{
+			fprintf(out, "%-8s %10s %9s %10u %7.1f%%\n", "garbage", "", "", _garbageBytes, 100.0 * _garbageBytes / bytes);
+		}
+
+		fprintf(out, "\n%-8s %10s %9s %10s %8s\n", "address", "frames", "frames/s", "bytes", "share");
+		for (uint8_t address = 0; address < 16; address++)
+		{
+			const Counter& counter = _addressTotals[address];
+			if (counter.frames > 0)
+			{
+				fprintf(out, "%-8u %10u %9.2f %10u %7.1f%%\n", address, counter.frames, counter.frames / seconds, counter.bytes,
+					100.0 * counter.bytes / bytes);
+			}
+		}
+	}
+
+private:
+	static void Add(Counter& bucket, Counter& total, size_t length, bool valid)
+	{
+		bucket.frames++;
+		bucket.bytes += length;
+		total.frames++;
+		total.bytes += length;
+		if (!valid)
+		{
+			bucket.errors++;
+			total.errors++;
+		}
+	}
+
+	static void Subtract(Counter& bucket, Counter& total)
+	{
+		total.frames -= bucket.frames;
+		total.bytes -= bucket.bytes;
+		total.errors -= bucket.errors;
+		bucket = Counter();
+	}
+
+	void Expire(Bucket& bucket)
+	{
+		for (uint16_t slot : bucket.touched)
+		{
+			Subtract(bucket.types[slot], _totals[slot]);
+		}
+		bucket.touched.clear();
+
+		for (uint8_t address = 0; address < 16; address++)
+		{
+			Subtract(bucket.addresses[address], _addressTotals[address]);
+		}
+
+		_garbageBytes -= bucket.garbageBytes;
+		bucket.garbageBytes = 0;
+	}
+
+	std::vector<Bucket> _buckets;
+	std::vector<Counter> _totals;
+	Counter _addressTotals[16];
+	uint32_t _garbageBytes = 0;
+	uint64_t _current = 0;
+	uint64_t _elapsed = 0;
+	bool _started = false;
+};
+
+// Configures a serial device for receiving the bus: 1200 baud, 7 data bits, even parity, 2 stop bits, raw mode
+static bool ConfigureSerial(int fd)
+{
+	struct termios options;
+	if (tcgetattr(fd, &options) != 0)
+	{
+		return false;
+	}
+
+	cfmakeraw(&options);
+	cfsetispeed(&options, B1200);
+	cfsetospeed(&options, B1200);
+	options.c_cflag &= ~(CSIZE | PARODD | CRTSCTS);
+	options.c_cflag |= CS7 | PARENB | CSTOPB | CREAD | CLOCAL;
+
+	// Strip the parity bit, bytes with parity errors are passed as they are and fail the checksum
+	options.c_iflag |= ISTRIP;
+	options.c_iflag &= ~(INPCK | IXON | IXOFF);
+
+	// Block until at least one byte arrives, but return after 0.5 s so the dashboard keeps updating on a silent bus
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 5;
+	return tcsetattr(fd, TCSANOW, &options) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	unsigned window = 60;
+	const char* path = nullptr;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+		{
+			window = std::max(1, atoi(argv[++i]));
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	if (path == nullptr)
+	{
+		fprintf(stderr, "Usage: %s [--window seconds] /dev/ttyUSB0 | capture.bin | -\n", argv[0]);
+		return 2;
+	}
+
+	int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_NOCTTY);
+	if (fd < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	bool live = isatty(fd);
+	if (live && !ConfigureSerial(fd))
+	{
+		perror(path);
+		return 1;
+	}
+
+	Monitor monitor(window);
+	auto start = std::chrono::steady_clock::now();
+	uint64_t position = 0;
+	uint64_t lastPrinted = 0;
+
+	uint8_t frame[MaxFrameLength + 2];
+	size_t length = 0;
+	bool awaitingChecksum = false;
+
+	uint8_t buffer[4096];
+	while (true)
+	{
+		ssize_t count = read(fd, buffer, sizeof(buffer));
+		if (count < 0 || (count == 0 && !live))
+		{
+			break;
+		}
+
+		uint64_t second = 0;
+		if (live)
+		{
+			second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count();
+			monitor.Advance(second);
+		}
+
+		for (ssize_t i = 0; i < count; i++)
+		{
+			if (!live)
+			{
+				monitor.Advance((uint64_t)(position++ * ByteMicros / 1000000));
+			}
+
+			uint8_t value = buffer[i];
+			if (length >= sizeof(frame))
+			{
+				monitor.AddGarbage(length);
+				length = 0;
+				awaitingChecksum = false;
+			}
+			frame[length++] = value;
+
+			if (!awaitingChecksum)
+			{
+				awaitingChecksum = value == '\r';
+				continue;
+			}
+
+			// The checksum covers every byte including the CR, starting at 0x7F
+			uint8_t checksum = 0x7F;
+			for (size_t j = 0; j + 1 < length; j++)
+			{
+				checksum ^= frame[j];
+			}
+			monitor.AddFrame(frame, length, checksum == value);
+			length = 0;
+			awaitingChecksum = false;
+		}
+
+		if (live && second != lastPrinted)
+		{
+			lastPrinted = second;
+			printf("\033[H\033[2J");
+			monitor.Print(stdout);
+			fflush(stdout);
+		}
+	}
+
+	monitor.Print(stdout);
+	return 0;
+}
@@ -0,0 +1,403 @@
+// ArduinoIBIS
+// Host tool header: shared-memory submission ring between ibis_daemon and its local clients (Linux)
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// A client creates a ring in a memfd together with two eventfds, and hands all three to the daemon over its Unix
+// socket (SCM_RIGHTS). From then on, the client writes telegrams into the ring and the daemon writes them to the bus
+// straight from the shared memory, without a syscall or a copy per telegram on the client side.
+//
+// The ring is single producer, single consumer: one client thread writes, the daemon reads. Clients which feed
+// several buses (e.g. a simulator) open one ring per daemon.
+//
+// Layout: a RingHeader, then capacity bytes of records. A record is a RecordHeader followed by its data, padded to 4
+// bytes. Records never wrap around the end of the ring; if one doesn't fit in the rest, a Padding record fills it.
+// head and tail count bytes since the start and wrap at 2^32, the offset in the ring is position & (capacity - 1).
+//
+// Wake-ups: a side only signals the other's eventfd if the other announced that it's going to sleep (consumerWaiting,
+// producerWaiting), so a busy ring costs no syscalls at all. The sleeping side sets its flag, then checks the ring
+// again before it blocks, and the writing side checks the flag after publishing its position; with a full fence on
+// both sides, one of them is guaranteed to see the other.
+//
+// Records have the same format on the socket path (without ring), so both paths share the record parser.
+
+#pragma once
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IBIS_RING_MAGIC 0x474E5249 // "IRNG"
+#define IBIS_RING_VERSION 1
+#define IBIS_RING_DEFAULT_CAPACITY (64 * 1024)
+
+namespace IbisRing
+{
+	enum RecordKind : uint8_t
+	{
+		// Wire bytes ready to be sent (payload, CR and checksum)
+		Frame = 1,
+
+		// Payload only, the daemon adds CR and checksum
+		Payload = 2,
+
+		// Fills the rest of the ring before it wraps around
+		Padding = 3
+	};
+
+	struct RecordHeader
+	{
+		uint16_t length;
+		uint8_t kind;
+		uint8_t reserved;
+	};
+
+	struct RingHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t capacity;
+		uint32_t reserved;
+
+		// Producer and consumer positions on their own cache lines, so the two sides don't invalidate each other's
+		// lines on every record
+		alignas(64) std::atomic<uint32_t> head;
+		std::atomic<uint32_t> producerWaiting;
+		alignas(64) std::atomic<uint32_t> tail;
+		std::atomic<uint32_t> consumerWaiting;
+	};
+
+	static_assert(sizeof(RingHeader) == 192, "Ring header layout");
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "Ring positions must be lock free to be shared");
+
+	// Largest record data (a telegram is far smaller, this bounds what the daemon accepts)
+	static const uint16_t MaxRecordLength = 255;
+
+	// Smallest ring, so the largest record always fits
+	static const uint32_t MinCapacity = 1024;
+
+	inline uint32_t RecordSize(uint16_t length)
+	{
+		return (sizeof(RecordHeader) + length + 3) & ~3u;
+	}
+
+	// Wakes up the other side if it's waiting
+	inline void Signal(std::atomic<uint32_t>& waiting, int eventFd)
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (waiting.load(std::memory_order_relaxed) != 0)
+		{
+			uint64_t one = 1;
+			ssize_t ignored = write(eventFd, &one, sizeof(one));
+			(void)ignored;
+		}
+	}
+
+	// Client side: creates the ring and writes records into it
+	class Producer
+	{
+	public:
+		~Producer()
+		{
+			if (_ring != nullptr)
+			{
+				munmap(_ring, sizeof(RingHeader) + _capacity);
+			}
+			for (int fd : { _memoryFd, _dataFd, _spaceFd })
+			{
+				if (fd >= 0)
+				{
+					close(fd);
+				}
+			}
+		}
+
+		// Capacity must be a power of two
+		bool Create(uint32_t capacity = IBIS_RING_DEFAULT_CAPACITY)
+		{
+			if (capacity < MinCapacity || (capacity & (capacity - 1)) != 0)
+			{
+				errno = EINVAL;
+				return false;
+			}
+
+			_capacity = capacity;
+			size_t size = sizeof(RingHeader) + capacity;
+			_memoryFd = memfd_create("ibis-ring", MFD_CLOEXEC);
+			if (_memoryFd < 0 || ftruncate(_memoryFd, size) != 0)
+			{
+				return false;
+			}
+
+			void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _memoryFd, 0);
+			if (memory == MAP_FAILED)
+			{
+				return false;
+			}
+
+			_ring = new (memory) RingHeader();
+			_ring->magic = IBIS_RING_MAGIC;
+			_ring->version = IBIS_RING_VERSION;
+			_ring->capacity = capacity;
+			_data = (uint8_t*)memory + sizeof(RingHeader);
+
+			_dataFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			_spaceFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+			return _dataFd >= 0 && _spaceFd >= 0;
+		}
+
+		// Hands the ring to the daemon connected on socketFd
+		bool Attach(int socketFd)
+		{
+			int fds[3] = { _memoryFd, _dataFd, _spaceFd };
+			char control[CMSG_SPACE(sizeof(fds))] = {};
+			char tag = 'R';
+			iovec io = { &tag, 1 };
+
+			msghdr message = {};
+			message.msg_iov = &io;
+			message.msg_iovlen = 1;
+			message.msg_control = control;
+			message.msg_controllen = sizeof(control);
+
+			cmsghdr* header = CMSG_FIRSTHDR(&message);
+			header->cmsg_level = SOL_SOCKET;
+			header->cmsg_type = SCM_RIGHTS;
+			header->cmsg_len = CMSG_LEN(sizeof(fds));
+			memcpy(CMSG_DATA(header), fds, sizeof(fds));
+			return sendmsg(socketFd, &message, MSG_NOSIGNAL) == 1;
+		}
+
+		// Appends a record without blocking. Returns false if the ring is full
+		bool TryPush(RecordKind kind, const void* data, uint16_t length)
+		{
+			uint32_t head = _ring->head.load(std::memory_order_relaxed);
+			uint32_t tail = _ring->tail.load(std::memory_order_acquire);
+			uint32_t size = RecordSize(length);
+			uint32_t offset = head & (_capacity - 1);
+			uint32_t contiguous = _capacity - offset;
+			uint32_t padding = size > contiguous ? contiguous : 0;
+			if (head + padding + size - tail > _capacity)
+			{
+				return false;
+			}
+
+			if (padding != 0)
+			{
+				RecordHeader* pad = (RecordHeader*)(_data + offset);
+				pad->length = contiguous - sizeof(RecordHeader);
+				pad->kind = Padding;
+				head += padding;
+				offset = 0;
+			}
+
+			RecordHeader* record = (RecordHeader*)(_data + offset);
+			record->length = length;
+			record->kind = kind;
+			memcpy(record + 1, data, length);
+
+			_ring->head.store(head + size, std::memory_order_release);
+			Signal(_ring->consumerWaiting, _dataFd);
+			return true;
+		}
+
+		// Appends a record, waiting up to timeoutMs (-1 = forever) for the daemon to make room
+		bool Push(RecordKind kind, const void* data, uint16_t length, int timeoutMs = -1)
+		{
+			while (!TryPush(kind, data, length))
+			{
+				_ring->producerWaiting.store(1, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (TryPush(kind, data, length))
+				{
+					_ring->producerWaiting.store(0, std::memory_order_relaxed);
+					break;
+				}
+
+				pollfd fd = { _spaceFd, POLLIN, 0 };
+				int ready = poll(&fd, 1, timeoutMs);
+				_ring->producerWaiting.store(0, std::memory_order_relaxed);
+				if (ready <= 0)
+				{
+					return false;
+				}
+				uint64_t count;
+				ssize_t ignored = read(_spaceFd, &count, sizeof(count));
+				(void)ignored;
+			}
+			return true;
+		}
+
+		// Bytes not consumed by the daemon yet
+		uint32_t GetPending() const
+		{
+			return _ring->head.load(std::memory_order_relaxed) - _ring->tail.load(std::memory_order_acquire);
+		}
+
+	private:
+		RingHeader* _ring = nullptr;
+		uint8_t* _data = nullptr;
+		uint32_t _capacity = 0;
+		int _memoryFd = -1;
+		int _dataFd = -1;
+		int _spaceFd = -1;
+	};
+
+	// A record read from a ring, data points into the shared memory
+	struct Record
+	{
+		RecordKind kind;
+		uint16_t length;
+		const uint8_t* data;
+	};
+
+	// Daemon side: maps a client's ring and reads records in place. The ring memory is shared with the client, so
+	// everything in it is checked before it's used
+	class Consumer
+	{
+	public:
+		~Consumer()
+		{
+			if (_ring != nullptr)
+			{
+				munmap(_ring, sizeof(RingHeader) + _capacity);
+			}
+			for (int fd : { _dataFd, _spaceFd })
+			{
+				if (fd >= 0)
+				{
+					close(fd);
+				}
+			}
+		}
+
+		// Takes over the descriptors received from Producer::Attach()
+		bool Attach(int memoryFd, int dataFd, int spaceFd)
+		{
+			_dataFd = dataFd;
+			_spaceFd = spaceFd;
+
+			struct stat info;
+			RingHeader header;
+			bool valid = fstat(memoryFd, &info) == 0 && (size_t)info.st_size >= sizeof(RingHeader) &&
+				pread(memoryFd, &header, sizeof(header), 0) == sizeof(header) && header.magic == IBIS_RING_MAGIC &&
+				header.version == IBIS_RING_VERSION && header.capacity >= MinCapacity &&
+				(header.capacity & (header.capacity - 1)) == 0 && (size_t)info.st_size == sizeof(RingHeader) + header.capacity;
+			if (valid)
+			{
+				// The capacity is taken once, a client changing it later can't make the daemon read out of bounds
+				_capacity = header.capacity;
+				void* memory = mmap(nullptr, sizeof(RingHeader) + _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFd, 0);
+				if (memory != MAP_FAILED)
+				{
+					_ring = (RingHeader*)memory;
+					_data = (uint8_t*)memory + sizeof(RingHeader);
+					_tail = _ring->tail.load(std::memory_order_relaxed);
+					_read = _tail;
+				}
+			}
+
+			close(memoryFd);
+			return _ring != nullptr;
+		}
+
+		int GetDataFd() const { return _dataFd; }
+
+		// Gets the next record, returns false if the ring is empty. Records stay valid until Release(), so several of
+		// them can be written to the bus with one syscall. Sets broken if the client wrote garbage; the ring can't be
+		// used anymore then
+		bool Next(Record& record, bool& broken)
+		{
+			broken = false;
+			for (;;)
+			{
+				uint32_t head = _ring->head.load(std::memory_order_acquire);
+				uint32_t available = head - _read;
+				if (available == 0)
+				{
+					return false;
+				}
+
+				// The header is copied first, as the client could change it while it's checked
+				uint32_t offset = _read & (_capacity - 1);
+				RecordHeader header;
+				memcpy(&header, _data + offset, sizeof(header));
+				uint32_t size = header.kind == Padding ? _capacity - offset : RecordSize(header.length);
+				if (head - _tail > _capacity || size > available || offset + size > _capacity ||
+					(header.kind != Padding && (header.length > MaxRecordLength || (header.kind != Frame && header.kind != Payload))))
+				{
+					broken = true;
+					return false;
+				}
+
+				_read += size;
+				if (header.kind != Padding)
+				{
+					record.kind = (RecordKind)header.kind;
+					record.length = header.length;
+					record.data = _data + offset + sizeof(RecordHeader);
+					return true;
+				}
+			}
+		}
+
+		// Frees all records returned by Next() so far. A waiting producer is only woken up once half of the ring is
+		// free, so it fills it in bursts instead of taking turns with the daemon record by record
+		void Release()
+		{
+			if (_read == _tail)
+			{
+				return;
+			}
+
+			_tail = _read;
+			_ring->tail.store(_tail, std::memory_order_release);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_ring->head.load(std::memory_order_relaxed) - _tail <= _capacity / 2)
+			{
+				Signal(_ring->producerWaiting, _spaceFd);
+			}
+		}
+
+		// Call before blocking on the data eventfd. Returns false if records arrived meanwhile, don't block then
+		bool PrepareWait()
+		{
+			_ring->consumerWaiting.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_ring->head.load(std::memory_order_relaxed) != _read)
+			{
+				_ring->consumerWaiting.store(0, std::memory_order_relaxed);
+				return false;
+			}
+			return true;
+		}
+
+		// Call after the data eventfd became readable
+		void FinishWait()
+		{
+			uint64_t count;
+			ssize_t ignored = read(_dataFd, &count, sizeof(count));
+			(void)ignored;
+			_ring->consumerWaiting.store(0, std::memory_order_relaxed);
+		}
+
+	private:
+		RingHeader* _ring = nullptr;
+		uint8_t* _data = nullptr;
+		uint32_t _capacity = 0;
+		uint32_t _tail = 0;
+		uint32_t _read = 0;
+		int _dataFd = -1;
+		int _spaceFd = -1;
+	};
+}
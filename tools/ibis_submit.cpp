@@ -0,0 +1,156 @@
+// ArduinoIBIS
+// Host tool: submits telegrams to ibis_daemon, through a shared-memory ring or the socket
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// Sends the telegram payloads given on the command line (or one per line on stdin), e.g. "zA1Hauptbahnhof"; the
+// daemon adds CR and checksum. By default they go through a shared-memory ring (see ibis_ring.h), --stream writes them
+// to the socket instead.
+//
+// --bench count submits the first payload count times as fast as possible and prints the rate, until the daemon took
+// all of them. Run the daemon with /dev/null as the bus to compare the two paths without waiting for the bus.
+//
+// Build: g++ -O2 -std=c++17 tools/ibis_submit.cpp -o ibis_submit
+// Usage: ibis_submit [--socket /tmp/ibis.sock] [--stream] [--bench count] [payload...]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/un.h>
+
+#include "ibis_ring.h"
+
+static bool SendAll(int fd, const void* data, size_t length)
+{
+	const uint8_t* bytes = (const uint8_t*)data;
+	while (length > 0)
+	{
+		ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+		if (sent <= 0)
+		{
+			return false;
+		}
+		bytes += sent;
+		length -= sent;
+	}
+	return true;
+}
+
+// Stream path: the record is built and sent with one syscall per telegram
+static bool SubmitStream(int fd, const std::string& payload)
+{
+	uint8_t record[sizeof(IbisRing::RecordHeader) + IbisRing::MaxRecordLength + 3] = {};
+	IbisRing::RecordHeader header = { (uint16_t)payload.size(), IbisRing::Payload, 0 };
+	memcpy(record, &header, sizeof(header));
+	memcpy(record + sizeof(header), payload.data(), payload.size());
+	return SendAll(fd, record, IbisRing::RecordSize(header.length));
+}
+
+int main(int argc, char** argv)
+{
+	const char* socketPath = "/tmp/ibis.sock";
+	bool stream = false;
+	long bench = 0;
+	std::vector<std::string> payloads;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+		{
+			stream = true;
+		}
+		else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+		{
+			bench = atol(argv[++i]);
+		}
+		else if (strncmp(argv[i], "--", 2) == 0)
+		{
+			fprintf(stderr, "Usage: %s [--socket /tmp/ibis.sock] [--stream] [--bench count] [payload...]\n", argv[0]);
+			return 2;
+		}
+		else
+		{
+			payloads.push_back(argv[i]);
+		}
+	}
+
+	if (payloads.empty() && bench > 0)
+	{
+		payloads.push_back("zA1Hauptbahnhof");
+	}
+	if (payloads.empty())
+	{
+		char line[512];
+		while (fgets(line, sizeof(line), stdin) != nullptr)
+		{
+			line[strcspn(line, "\r\n")] = '\0';
+			if (line[0] != '\0')
+			{
+				payloads.push_back(line);
+			}
+		}
+	}
+	for (const std::string& payload : payloads)
+	{
+		if (payload.size() > IbisRing::MaxRecordLength)
+		{
+			fprintf(stderr, "Payload too long: %s\n", payload.c_str());
+			return 1;
+		}
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+	if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+	{
+		perror(socketPath);
+		return 1;
+	}
+
+	IbisRing::Producer ring;
+	if (!stream && (!ring.Create() || !ring.Attach(fd)))
+	{
+		perror("ring");
+		return 1;
+	}
+
+	auto submit = [&](const std::string& payload)
+	{
+		return stream ? SubmitStream(fd, payload) : ring.Push(IbisRing::Payload, payload.data(), payload.size());
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	long count = bench > 0 ? bench : (long)payloads.size();
+	for (long i = 0; i < count; i++)
+	{
+		if (!submit(payloads[bench > 0 ? 0 : i]))
+		{
+			perror("submit");
+			return 1;
+		}
+	}
+
+	// The ring belongs to this process, so wait until the daemon took everything before exiting
+	while (!stream && ring.GetPending() != 0)
+	{
+		usleep(100);
+	}
+
+	if (bench > 0)
+	{
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("%ld telegrams in %.3f s (%.0f per second, %s)\n", count, seconds, count / seconds, stream ? "stream" : "ring");
+	}
+
+	close(fd);
+	return 0;
+}
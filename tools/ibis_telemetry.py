@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# ArduinoIBIS
+# Decoder for the telemetry records produced by Port::SetTelemetryCallback()
+
+# Copyright (c) 2025 Jonathan Verbeek
+# Licensed under the MIT License, see LICENSE
+
+# Record layout (version 2), all numbers are unsigned LEB128 varints:
+#   uint8   version
+#   varint  interval duration in ms
+#   varint  telegrams sent
+#   varint  bytes sent
+#   varint  send errors
+#   varint  latency histogram, 8 buckets (<32ms, <64ms, ... <2048ms, >=2048ms)
+#   varint  max latency in ms
+#   varint  telegrams received (version 2 and later)
+#   varint  receive errors (version 2 and later)
+#   varint  longest Port::Run() call in microseconds (version 2 and later)
+#
+# Records are self-delimiting, so any number of them can be concatenated in a file.
+# Usage: ibis_telemetry.py [file]  (reads from stdin if no file is given, prints one JSON object per record)
+
+import json
+import sys
+
+LATENCY_BUCKETS = 8
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise ValueError("truncated varint")
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def decode_record(data, pos=0):
+    version = data[pos]
+    pos += 1
+    if version not in (1, 2):
+        raise ValueError("unsupported telemetry version %d" % version)
+
+    count = 4 + LATENCY_BUCKETS + 1
+    if version >= 2:
+        count += 3
+
+    fields = []
+    for _ in range(count):
+        value, pos = read_varint(data, pos)
+        fields.append(value)
+
+    record = {
+        "version": version,
+        "interval_ms": fields[0],
+        "telegrams_sent": fields[1],
+        "bytes_sent": fields[2],
+        "send_errors": fields[3],
+        "latency_histogram": fields[4:4 + LATENCY_BUCKETS],
+        "max_latency_ms": fields[4 + LATENCY_BUCKETS],
+    }
+    if version >= 2:
+        record["telegrams_received"] = fields[5 + LATENCY_BUCKETS]
+        record["receive_errors"] = fields[6 + LATENCY_BUCKETS]
+        record["max_run_us"] = fields[7 + LATENCY_BUCKETS]
+    return record, pos
+
+
+def main():
+    if len(sys.argv) > 1:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    pos = 0
+    while pos < len(data):
+        record, pos = decode_record(data, pos)
+        print(json.dumps(record))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,256 @@
+// ArduinoIBIS
+// Host tool: feeds VDV 301 CustomerInformationService documents through CustomerInformationGateway and shows the
+// telegrams it sends
+
+// Copyright (c) 2025 Jonathan Verbeek
+// Licensed under the MIT License, see LICENSE
+
+// Runs the same CustomerInformationGateway and Port as the target (built against the Arduino stand-ins in tools/host),
+// so recorded documents can be checked on the PC before going to the vehicle. Every telegram is shown as it would go
+// on the wire, with its address, transcoded text and checksum. Documents are given as files (read in pieces of --chunk bytes, to
+// exercise the streaming parser like a TCP connection would) or received on localhost: with --listen, every HTTP
+// request body (e.g. the AllData documents an on-board computer or a simulator posts to a subscriber) is parsed as
+// it arrives.
+//
+// Build: g++ -O2 -std=c++17 -I tools/host -I src tools/ibis_vdv301.cpp src/*.cpp -o ibis_vdv301
+// Usage: ibis_vdv301 [--chunk bytes] [--address n] document.xml...
+//        ibis_vdv301 [--address n] --listen port
+//        e.g. curl --data-binary @document.xml http://localhost:8301/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ArduinoIBISGateway.h"
+
+using namespace ArduinoIBIS;
+
+// Frames the port sent while a piece of input was fed
+static std::vector<std::string> Sent;
+
+static void CaptureFrame(const uint8_t* frame, uint8_t length, uint8_t flags, void*)
+{
+	if (!(flags & CaptureReceived))
+	{
+		Sent.emplace_back((const char*)frame, length);
+	}
+}
+
+// Prints a frame as its payload (characters outside of printable ASCII as hex) and checksum
+static void PrintFrame(const std::string& frame)
+{
+	printf("  ");
+	for (size_t i = 0; i + 2 < frame.size(); i++)
+	{
+		uint8_t value = frame[i];
+		if (value >= 0x20 && value < 0x7F && value != '\\')
+		{
+			putchar(value);
+		}
+		else
+		{
+			printf("\\x%02X", value);
+		}
+	}
+	printf("  (checksum %02X)\n", (uint8_t)frame.back());
+}
+
+// Feeds a piece of input and prints the telegrams for the documents it completed. A piece which completes several
+// documents is reported as one, like the gateway sends the changes of all of them at once
+static void Feed(CustomerInformationGateway& gateway, const char* data, size_t length)
+{
+	const CustomerInformationParser& parser = gateway.GetParser();
+	uint32_t documents = parser.GetStatistics().documents;
+	Sent.clear();
+	gateway.Feed(data, length);
+
+	uint32_t completed = parser.GetStatistics().documents;
+	if (completed == documents)
+	{
+		return;
+	}
+
+	if (completed - documents > 1)
+	{
+		printf("documents %u-%u:", documents + 1, completed);
+	}
+	else
+	{
+		printf("document %u:", completed);
+	}
+	printf(Sent.empty() ? " unchanged\n" : "\n");
+	for (const std::string& frame : Sent)
+	{
+		PrintFrame(frame);
+	}
+}
+
+static void PrintStatistics(const CustomerInformationGateway& gateway)
+{
+	const CustomerInformationStatistics& stats = gateway.GetParser().GetStatistics();
+	printf("%u documents, %u unchanged, %u errors, %u truncated\n", stats.documents, stats.unchanged, stats.errors, stats.truncated);
+}
+
+static int ReplayFiles(CustomerInformationGateway& gateway, int count, char** paths, size_t chunk)
+{
+	std::vector<char> buffer(chunk);
+	for (int i = 0; i < count; i++)
+	{
+		FILE* file = fopen(paths[i], "rb");
+		if (file == nullptr)
+		{
+			perror(paths[i]);
+			return 1;
+		}
+
+		size_t length;
+		while ((length = fread(buffer.data(), 1, buffer.size(), file)) > 0)
+		{
+			Feed(gateway, buffer.data(), length);
+		}
+		fclose(file);
+
+		// A file that ended inside a document must not spill into the next one
+		gateway.Reset();
+	}
+
+	PrintStatistics(gateway);
+	return 0;
+}
+
+// Handles one HTTP request: skips the headers and feeds the body as it arrives
+static void HandleConnection(int client, CustomerInformationGateway& gateway)
+{
+	char buffer[1024];
+	std::string headers;
+	long remaining = -1;
+	bool inBody = false;
+
+	ssize_t length;
+	while (remaining != 0 && (length = recv(client, buffer, sizeof(buffer), 0)) > 0)
+	{
+		const char* body = buffer;
+		if (!inBody)
+		{
+			headers.append(buffer, length);
+			size_t end = headers.find("\r\n\r\n");
+			if (end == std::string::npos)
+			{
+				continue;
+			}
+
+			for (size_t line = 0; line < end; line = headers.find("\r\n", line) + 2)
+			{
+				if (strncasecmp(headers.c_str() + line, "Content-Length:", 15) == 0)
+				{
+					remaining = strtol(headers.c_str() + line + 15, nullptr, 10);
+				}
+			}
+
+			// What came after the headers in this piece
+			size_t bodyLength = headers.size() - end - 4;
+			body = buffer + length - bodyLength;
+			length = bodyLength;
+			inBody = true;
+		}
+
+		if (remaining >= 0 && length > remaining)
+		{
+			length = remaining;
+		}
+		Feed(gateway, body, length);
+		if (remaining > 0)
+		{
+			remaining -= length;
+		}
+	}
+
+	gateway.Reset();
+	const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	send(client, response, strlen(response), 0);
+	close(client);
+}
+
+static int Listen(CustomerInformationGateway& gateway, int port)
+{
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(server, (sockaddr*)&address, sizeof(address)) < 0 || listen(server, 4) < 0)
+	{
+		perror("listen");
+		return 1;
+	}
+	fprintf(stderr, "Listening on http://localhost:%d/\n", port);
+
+	for (;;)
+	{
+		int client = accept(server, nullptr, nullptr);
+		if (client < 0)
+		{
+			perror("accept");
+			return 1;
+		}
+		HandleConnection(client, gateway);
+		fflush(stdout);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	size_t chunk = 4096;
+	uint8_t progressAddress = IBIS_CIS_PROGRESS_ADDRESS;
+	int port = -1;
+	int i = 1;
+	for (; i < argc && strncmp(argv[i], "--", 2) == 0; i += 2)
+	{
+		if (i + 1 >= argc)
+		{
+			break;
+		}
+		if (strcmp(argv[i], "--chunk") == 0)
+		{
+			chunk = strtoul(argv[i + 1], nullptr, 10);
+		}
+		else if (strcmp(argv[i], "--address") == 0)
+		{
+			progressAddress = atoi(argv[i + 1]);
+		}
+		else if (strcmp(argv[i], "--listen") == 0)
+		{
+			port = atoi(argv[i + 1]);
+		}
+	}
+
+	// The port sends right away, its capture callback sees every frame
+	Port ibis;
+	ibis.Begin();
+	ibis.SetCaptureCallback(CaptureFrame);
+	CustomerInformationGateway gateway(ibis, progressAddress);
+
+	if (port > 0)
+	{
+		return Listen(gateway, port);
+	}
+	if (i < argc && chunk > 0)
+	{
+		return ReplayFiles(gateway, argc - i, argv + i, chunk);
+	}
+
+	fprintf(stderr, "Usage: %s [--chunk bytes] [--address n] document.xml...\n"
+		"       %s [--address n] --listen port\n", argv[0], argv[0]);
+	return 2;
+}